@@ -0,0 +1,150 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+//
+// DeflateStream.cc
+//
+// This file is part of BES JSON File Out Module
+//
+// Copyright (c) 2014 OPeNDAP, Inc.
+// Author: Nathan Potter <ndp@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+// (c) COPYRIGHT URI/MIT 1995-1999
+// Please read the full copyright statement in the file COPYRIGHT_URI.
+//
+
+
+#include "config.h"
+
+#include <climits>
+
+#include <BESInternalError.h>
+
+#include "DeflateStream.h"
+#include "StreamFailed.h"
+
+namespace fojson {
+
+/**
+ * @param strm Write the compressed data to this stream
+ * @param compression deflate_compression (zlib format) or gzip_compression
+ * @param level zlib compression level, 0 (none) to 9 (best)
+ * @param buffer_size Size of each of the input and output buffers
+ * @throws BESInternalError if zlib cannot be initialized
+ */
+DeflateStreambuf::DeflateStreambuf(std::ostream &strm, Compression compression, int level, size_t buffer_size) :
+    _strm(strm), _in(buffer_size), _out(buffer_size), _finished(false)
+{
+    _zs.zalloc = Z_NULL;
+    _zs.zfree = Z_NULL;
+    _zs.opaque = Z_NULL;
+
+    // 15 is the largest window; adding 16 selects the gzip header and trailer
+    int window_bits = compression == gzip_compression ? 15 + 16 : 15;
+    if (deflateInit2(&_zs, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw BESInternalError("File out JSON, could not initialize compression.", __FILE__, __LINE__);
+
+    setp(&_in[0], &_in[0] + _in.size());
+}
+
+DeflateStreambuf::~DeflateStreambuf()
+{
+    deflateEnd(&_zs);
+}
+
+// Compress n bytes, writing the compressed data to the stream each time the
+// output buffer fills and once more at the end.
+void DeflateStreambuf::deflate_input(const char *s, size_t n, int flush)
+{
+    do {
+        // avail_in is an unsigned int
+        uInt chunk = n > UINT_MAX ? UINT_MAX : uInt(n);
+        _zs.next_in = (Bytef *) s;
+        _zs.avail_in = chunk;
+        s += chunk;
+        n -= chunk;
+
+        int chunk_flush = n ? Z_NO_FLUSH : flush;
+        do {
+            _zs.next_out = (Bytef *) &_out[0];
+            _zs.avail_out = _out.size();
+            if (deflate(&_zs, chunk_flush) == Z_STREAM_ERROR)
+                throw BESInternalError("File out JSON, compression failed.", __FILE__, __LINE__);
+
+            size_t have = _out.size() - _zs.avail_out;
+            if (have && !_strm.write(&_out[0], have))
+                throw StreamFailed();
+        } while (_zs.avail_out == 0);
+    } while (n);
+}
+
+// Compress what has been written to the input buffer and empty it
+void DeflateStreambuf::deflate_buffer(int flush)
+{
+    deflate_input(pbase(), pptr() - pbase(), flush);
+    setp(&_in[0], &_in[0] + _in.size());
+}
+
+DeflateStreambuf::int_type DeflateStreambuf::overflow(int_type c)
+{
+    if (_finished) throw BESInternalError("File out JSON, write after the end of the compressed response.", __FILE__, __LINE__);
+
+    deflate_buffer(Z_NO_FLUSH);
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+
+    return traits_type::not_eof(c);
+}
+
+// Blocks larger than the input buffer are compressed in place rather than
+// copied into it first.
+std::streamsize DeflateStreambuf::xsputn(const char *s, std::streamsize n)
+{
+    if (n < epptr() - pptr()) return std::streambuf::xsputn(s, n);
+
+    if (_finished) throw BESInternalError("File out JSON, write after the end of the compressed response.", __FILE__, __LINE__);
+
+    deflate_buffer(Z_NO_FLUSH);
+    deflate_input(s, n, Z_NO_FLUSH);
+
+    return n;
+}
+
+// Make everything written so far decodable by the client
+int DeflateStreambuf::sync()
+{
+    if (!_finished) deflate_buffer(Z_SYNC_FLUSH);
+    _strm.flush();
+
+    return _strm ? 0 : -1;
+}
+
+/**
+ * Compress anything still buffered, write the end of the compressed stream
+ * and flush the underlying stream. Nothing may be written after this.
+ */
+void DeflateStreambuf::finish()
+{
+    if (_finished) return;
+
+    deflate_buffer(Z_FINISH);
+    _finished = true;
+    _strm.flush();
+}
+
+} // namespace fojson
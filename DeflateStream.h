@@ -0,0 +1,114 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+//
+// DeflateStream.h
+//
+// This file is part of BES JSON File Out Module
+//
+// Copyright (c) 2014 OPeNDAP, Inc.
+// Author: Nathan Potter <ndp@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+// (c) COPYRIGHT URI/MIT 1995-1999
+// Please read the full copyright statement in the file COPYRIGHT_URI.
+//
+
+#ifndef FOJSON_DEFLATESTREAM_H_
+#define FOJSON_DEFLATESTREAM_H_ 1
+
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+#include <zlib.h>
+
+#include "fojson_utils.h"
+
+namespace fojson {
+
+/**
+ * @brief A streambuf that compresses what is written to it and passes the
+ * compressed bytes on to another stream.
+ *
+ * Both the uncompressed and the compressed data are held in buffers of a
+ * fixed size, so the whole document never has to be in memory. sync() (and
+ * so std::ostream::flush()) compresses everything written so far and flushes
+ * it to the underlying stream so the client can decode it. finish() must be
+ * called once the document is complete to write the end of the compressed
+ * stream.
+ *
+ * Errors throw BESInternalError; DeflateStream sets its exception mask so
+ * these reach the caller.
+ */
+class DeflateStreambuf: public std::streambuf {
+private:
+    std::ostream &_strm;
+    z_stream _zs;
+    std::vector<char> _in;
+    std::vector<char> _out;
+    bool _finished;
+
+    void deflate_input(const char *s, size_t n, int flush);
+    void deflate_buffer(int flush);
+
+    DeflateStreambuf(const DeflateStreambuf &);
+    DeflateStreambuf &operator=(const DeflateStreambuf &);
+
+protected:
+    virtual int_type overflow(int_type c);
+    virtual std::streamsize xsputn(const char *s, std::streamsize n);
+    virtual int sync();
+
+public:
+    /// Size of each of the two buffers used when none is given to the constructor
+    static const size_t default_buffer_size = 64 * 1024;
+
+    DeflateStreambuf(std::ostream &strm, Compression compression, int level,
+        size_t buffer_size = default_buffer_size);
+    virtual ~DeflateStreambuf();
+
+    void finish();
+};
+
+/**
+ * @brief An output stream that compresses with a DeflateStreambuf.
+ */
+class DeflateStream: public std::ostream {
+private:
+    DeflateStreambuf _buf;
+
+public:
+    /**
+     * @param strm Write the compressed data to this stream
+     * @param compression deflate_compression or gzip_compression
+     * @param level zlib compression level, 0 (none) to 9 (best)
+     */
+    DeflateStream(std::ostream &strm, Compression compression, int level) :
+        std::ostream(0), _buf(strm, compression, level)
+    {
+        rdbuf(&_buf);
+        exceptions(std::ios::badbit);
+    }
+
+    virtual ~DeflateStream() { }
+
+    /// Write the end of the compressed stream and flush the underlying stream
+    void finish() { _buf.finish(); }
+};
+
+} // namespace fojson
+
+#endif /* FOJSON_DEFLATESTREAM_H_ */
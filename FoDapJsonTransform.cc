@@ -30,6 +30,7 @@
 
 #include <cassert>
 
+#include <algorithm>
 #include <sstream>
 #include <iostream>
 #include <fstream>
@@ -46,7 +47,6 @@ using std::istringstream;
 #include <Array.h>
 #include <Grid.h>
 #include <Sequence.h>
-#include <Float64.h>
 #include <Str.h>
 #include <Url.h>
 
@@ -57,145 +57,195 @@ using std::istringstream;
 
 #include "FoDapJsonTransform.h"
 #include "fojson_utils.h"
+#include "fojson_format.h"
+#include "JsonWriter.h"
+#include "VariableWriter.h"
 
 #define FoDapJsonTransform_debug_key "fojson"
 
-const int int_64_precision = 15; // 15 digits to the right of the decimal point. jhrg 9/14/15
-
 /**
- *  @TODO Handle String and URL Arrays including backslash escaping double quotes in values.
- *
+ * Writes the values of an n-dimensional array. Uses recursion; the values of
+ * the innermost dimension are contiguous and are written in one go.
  */
 template<typename T>
-unsigned int FoDapJsonTransform::json_simple_type_array_worker(ostream *strm, T *values, unsigned int indx,
-    vector<unsigned int> *shape, unsigned int currentDim)
+uint64_t FoDapJsonTransform::json_simple_type_array_worker(fojson::JsonWriter *writer, const T *values,
+    uint64_t indx, vector<unsigned int> *shape, unsigned int currentDim)
 {
-    *strm << "[";
+    writer->raw('[');
 
     unsigned int currentDimSize = (*shape)[currentDim];
 
-    for (unsigned int i = 0; i < currentDimSize; i++) {
-        if (currentDim < shape->size() - 1) {
+    if (currentDim < shape->size() - 1) {
+        for (unsigned int i = 0; i < currentDimSize; i++) {
             BESDEBUG(FoDapJsonTransform_debug_key,
                 "json_simple_type_array_worker() - Recursing! indx:  " << indx << " currentDim: " << currentDim << " currentDimSize: " << currentDimSize << endl);
-            indx = json_simple_type_array_worker<T>(strm, values, indx, shape, currentDim + 1);
-            if (i + 1 != currentDimSize) *strm << ", ";
+            indx = json_simple_type_array_worker<T>(writer, values, indx, shape, currentDim + 1);
+            if (i + 1 != currentDimSize) writer->separator();
         }
-        else {
-            if (i) *strm << ", ";
-            if (typeid(T) == typeid(std::string)) {
-                // Strings need to be escaped to be included in a JSON object.
-                string val = reinterpret_cast<string*>(values)[indx++]; // ((string *) values)[indx++];
-                *strm << "\"" << fojson::escape_for_json(val) << "\"";
+    }
+    else {
+        writer->checkpoint();
+        fojson::write_values(writer, values + indx, currentDimSize, _value_format);
+        indx += currentDimSize;
+    }
+    writer->raw(']');
+
+    return indx;
+}
+
+/**
+ * Writes the values of a large Array that has not been read yet, reading it
+ * a slab of rows of its outermost dimension at a time. Only one slab is in
+ * memory at once. The output is the same as json_simple_type_array_worker()
+ * writes for the whole Array.
+ */
+template<typename T>
+uint64_t FoDapJsonTransform::json_simple_type_array_slabs(fojson::JsonWriter *writer, libdap::Array *a,
+    vector<unsigned int> *shape, unsigned int slab_rows)
+{
+    unsigned int rows = (*shape)[0];
+    uint64_t row_values = fojson::row_size(*shape);
+    uint64_t indx = 0;
+
+    writer->raw('[');
+
+    for (unsigned int first = 0; first < rows; first += slab_rows) {
+        unsigned int n = std::min(slab_rows, rows - first);
+
+        // Send what has been written while the slab is read
+        writer->flush();
+        libdap::Array *slab = fojson::read_slab(a, first, n);
+        try {
+            if ((uint64_t) slab->length() < n * row_values)
+                throw BESInternalError("File out JSON, a slab of Array " + a->name() + " holds fewer values than its shape.",
+                    __FILE__, __LINE__);
+            const T *values = reinterpret_cast<const T *>(slab->get_buf());
+
+            if (shape->size() == 1) {
+                if (first) writer->separator();
+                writer->checkpoint();
+                fojson::write_values(writer, values, n, _value_format);
             }
             else {
-                *strm << values[indx++];
+                for (unsigned int i = 0; i < n; i++) {
+                    if (first + i) writer->separator();
+                    json_simple_type_array_worker<T>(writer, values, i * row_values, shape, 1);
+                }
             }
         }
+        catch (...) {
+            delete slab;
+            throw;
+        }
+        delete slab;
+
+        indx += n * row_values;
     }
-    *strm << "]";
+
+    writer->raw(']');
 
     return indx;
 }
 
+/**
+ * Writes the "shape" property of an array: its constrained size in each dimension.
+ */
+void FoDapJsonTransform::writeShape(fojson::JsonWriter *writer, const vector<unsigned int> &shape, const string &indent)
+{
+    writer->raw(indent).key("shape").raw('[');
+
+    for (std::vector<unsigned int>::size_type i = 0; i < shape.size(); i++) {
+        if (i > 0) writer->raw(',');
+        writer->number(shape[i]);
+    }
+    writer->raw(']');
+}
+
 /**
  * Writes the json representation of the passed DAP Array of simple types. If the
  * parameter "sendData" evaluates to true then data will also be sent.
  */
 template<typename T>
-void FoDapJsonTransform::json_simple_type_array(ostream *strm, libdap::Array *a, string indent, bool sendData)
+void FoDapJsonTransform::json_simple_type_array(fojson::JsonWriter *writer, libdap::Array *a, const string &indent,
+    bool sendData)
 {
-    *strm << indent << "{" << endl;\
-    string childindent = indent + _indent_increment;
+    writer->raw(indent).raw('{').newline();
+    const string &childindent = next_indent(indent);
 
-    writeLeafMetadata(strm, a, childindent);
+    writeLeafMetadata(writer, a, childindent);
 
     int numDim = a->dimensions(true);
     vector<unsigned int> shape(numDim);
-    long length = fojson::computeConstrainedShape(a, &shape);
+    uint64_t length = fojson::computeConstrainedShape(a, &shape);
 
-    *strm << childindent << "\"shape\": [";
-
-    for (std::vector<unsigned int>::size_type i = 0; i < shape.size(); i++) {
-        if (i > 0) *strm << ",";
-        *strm << shape[i];
-    }
-    *strm << "]";
+    writeShape(writer, shape, childindent);
 
     if (sendData) {
-        *strm << "," << endl;
+        writer->raw(',').newline();
 
         // Data
-        *strm << childindent << "\"data\": ";
-        unsigned int indx = 0;
-        vector<T> src(length);
-        a->value(&src[0]);
-
-        // I added this, and a corresponding block in FoInstance... because I fixed
-        // an issue in libdap::Float64 where the precision was not properly reset
-        // in it's print_val() method. Because of that error, precision was (left at)
-        // 15 when this code was called until I fixed that method. Then this code
-        // was not printing at the required precision. jhrg 9/14/15
-        if (typeid(T) == typeid(libdap::dods_float64)) {
-            streamsize prec = strm->precision(int_64_precision);
-            try {
-                indx = json_simple_type_array_worker(strm, &src[0], 0, &shape, 0);
-                strm->precision(prec);
-            }
-            catch(...) {
-                strm->precision(prec);
-                throw;
-            }
+        writer->raw(childindent).key("data");
+        uint64_t indx = 0;
+        _value_format.precision = _precision_spec.get_precision(a);
+
+        unsigned int slab_rows = fojson::slab_rows(a, shape, sizeof(T), _slab_bytes);
+        if (slab_rows) {
+            indx = json_simple_type_array_slabs<T>(writer, a, &shape, slab_rows);
         }
         else {
-            indx = json_simple_type_array_worker(strm, &src[0], 0, &shape, 0);
+            // Format the values straight from the Array's own buffer
+            read_data(writer, a);
+            if ((uint64_t) a->length() < length)
+                throw BESInternalError("File out JSON, Array " + a->name() + " holds fewer values than its constrained shape.",
+                    __FILE__, __LINE__);
+            const T *src = reinterpret_cast<const T *>(a->get_buf());
+
+            indx = json_simple_type_array_worker(writer, src, 0, &shape, 0);
         }
 
         assert(length == indx);
     }
 
-    *strm << endl << indent << "}";
+    writer->newline().raw(indent).raw('}');
 }
 
 /**
  * String version of json_simple_type_array(). This version exists because of the differing
  * type signatures of the libdap::Vector::value() methods for numeric and c++ string types.
  *
- * @param strm Write to this stream
+ * @param writer Write here
  * @param a Source Array - write out data or metadata from or about this Array
  * @param indent Indent the output so humans can make sense of it
  * @param sendData True: send data; false: send metadata
  */
-void FoDapJsonTransform::json_string_array(std::ostream *strm, libdap::Array *a, string indent, bool sendData)
+void FoDapJsonTransform::json_string_array(fojson::JsonWriter *writer, libdap::Array *a, const string &indent, bool sendData)
 {
-    *strm << indent << "{" << endl;\
-    string childindent = indent + _indent_increment;
+    writer->raw(indent).raw('{').newline();
+    const string &childindent = next_indent(indent);
 
-    writeLeafMetadata(strm, a, childindent);
+    writeLeafMetadata(writer, a, childindent);
 
     int numDim = a->dimensions(true);
     vector<unsigned int> shape(numDim);
-    long length = fojson::computeConstrainedShape(a, &shape);
+    uint64_t length = fojson::computeConstrainedShape(a, &shape);
 
-    *strm << childindent << "\"shape\": [";
-
-    for (std::vector<unsigned int>::size_type i = 0; i < shape.size(); i++) {
-        if (i > 0) *strm << ",";
-        *strm << shape[i];
-    }
-    *strm << "]";
+    writeShape(writer, shape, childindent);
 
     if (sendData) {
-        *strm << "," << endl;
+        writer->raw(',').newline();
 
         // Data
-        *strm << childindent << "\"data\": ";
-        unsigned int indx;
-
-        // The string type utilizes a specialized version of libdap:Array.value()
-        vector<std::string> sourceValues;
-        a->value(sourceValues);
-        indx = json_simple_type_array_worker(strm, (std::string *) (&sourceValues[0]), 0, &shape, 0);
+        writer->raw(childindent).key("data");
+        uint64_t indx;
+
+        // Write the strings from the Array's own storage; they are escaped
+        // straight into the writer
+        read_data(writer, a);
+        const std::vector<std::string> &values = a->get_str();
+        if ((uint64_t) values.size() < length)
+            throw BESInternalError("File out JSON, Array " + a->name() + " holds fewer values than its constrained shape.",
+                __FILE__, __LINE__);
+        indx = json_simple_type_array_worker(writer, length ? &values[0] : 0, 0, &shape, 0);
 
         if (length != indx)
             BESDEBUG(FoDapJsonTransform_debug_key,
@@ -203,21 +253,70 @@ void FoDapJsonTransform::json_string_array(std::ostream *strm, libdap::Array *a,
 
     }
 
-    *strm << endl << indent << "}";
+    writer->newline().raw(indent).raw('}');
+}
+
+/**
+ * Return the indent one level deeper than indent. Each depth's indent is
+ * made once and reused for the rest of the response, so writing a variable
+ * or attribute does not build new indent strings.
+ */
+const std::string &FoDapJsonTransform::next_indent(const std::string &indent)
+{
+    if (_indent_increment.empty()) return indent;
+
+    std::deque<std::string>::size_type depth = indent.length() / _indent_increment.length() + 1;
+    while (_indents.size() <= depth)
+        _indents.push_back(_indents.empty() ? std::string() : _indents.back() + _indent_increment);
+
+    return _indents[depth];
+}
+
+/** @name quoted_name
+ * Return the name of a variable, attribute table or attribute, escaped and
+ * enclosed in double quotes. The quoted name is computed the first time it
+ * is needed and then reused for the rest of the response; in a Sequence the
+ * same column names are written for every row.
+ */
+///@{
+const std::string &FoDapJsonTransform::quoted_name(libdap::BaseType *bt)
+{
+    std::map<const void *, std::string>::iterator i = _quoted_names.find(bt);
+    if (i == _quoted_names.end()) i = _quoted_names.insert(make_pair(bt, fojson::quote_for_json(bt->name()))).first;
+
+    return i->second;
+}
+
+const std::string &FoDapJsonTransform::quoted_name(libdap::AttrTable *atbl)
+{
+    std::map<const void *, std::string>::iterator i = _quoted_names.find(atbl);
+    if (i == _quoted_names.end()) i = _quoted_names.insert(make_pair(atbl, fojson::quote_for_json(atbl->get_name()))).first;
+
+    return i->second;
 }
 
+const std::string &FoDapJsonTransform::quoted_name(libdap::AttrTable &attr_table, libdap::AttrTable::Attr_iter at_iter)
+{
+    std::map<const void *, std::string>::iterator i = _quoted_names.find(*at_iter);
+    if (i == _quoted_names.end())
+        i = _quoted_names.insert(make_pair(*at_iter, fojson::quote_for_json(attr_table.get_name(at_iter)))).first;
+
+    return i->second;
+}
+///@}
+
 /**
  * Writes the json opener for the Dataset, including name and top level DAP attributes.
  */
-void FoDapJsonTransform::writeDatasetMetadata(ostream *strm, libdap::DDS *dds, string indent)
+void FoDapJsonTransform::writeDatasetMetadata(fojson::JsonWriter *writer, libdap::DDS *dds, const string &indent)
 {
 
     // Name
-    *strm << indent << "\"name\": \"" << dds->get_dataset_name() << "\"," << endl;
+    writer->raw(indent).key("name").quoted(dds->get_dataset_name()).raw(',').newline();
 
     //Attributes
-    transform(strm, dds->get_attr_table(), indent);
-    *strm << "," << endl;
+    transform(writer, dds->get_attr_table(), indent);
+    writer->raw(',').newline();
 
 }
 
@@ -225,15 +324,15 @@ void FoDapJsonTransform::writeDatasetMetadata(ostream *strm, libdap::DDS *dds, s
  * Writes json opener for a DAP object that is seen as a "node" in w10n semantics.
  * Header includes object name and attributes
  */
-void FoDapJsonTransform::writeNodeMetadata(ostream *strm, libdap::BaseType *bt, string indent)
+void FoDapJsonTransform::writeNodeMetadata(fojson::JsonWriter *writer, libdap::BaseType *bt, const string &indent)
 {
 
     // Name
-    *strm << indent << "\"name\": \"" << bt->name() << "\"," << endl;
+    writer->raw(indent).key("name").raw(quoted_name(bt)).raw(',').newline();
 
     //Attributes
-    transform(strm, bt->get_attr_table(), indent);
-    *strm << "," << endl;
+    transform(writer, bt->get_attr_table(), indent);
+    writer->raw(',').newline();
 
 }
 
@@ -241,24 +340,26 @@ void FoDapJsonTransform::writeNodeMetadata(ostream *strm, libdap::BaseType *bt,
  * Writes json opener for a DAP object that is seen as a "leaf" in w10n semantics.
  * Header includes object name. attributes, and  type.
  */
-void FoDapJsonTransform::writeLeafMetadata(ostream *strm, libdap::BaseType *bt, string indent)
+void FoDapJsonTransform::writeLeafMetadata(fojson::JsonWriter *writer, libdap::BaseType *bt, const string &indent)
 {
 
     // Name
-    *strm << indent << "\"name\": \"" << bt->name() << "\"," << endl;
+    writer->raw(indent).key("name").raw(quoted_name(bt)).raw(',').newline();
 
     // type
+    writer->raw(indent).key("type").raw('"');
     if (bt->type() == libdap::dods_array_c) {
         libdap::Array *a = (libdap::Array *) bt;
-        *strm << indent << "\"type\": \"" << a->var()->type_name() << "\"," << endl;
+        writer->raw(a->var()->type_name());
     }
     else {
-        *strm << indent << "\"type\": \"" << bt->type_name() << "\"," << endl;
+        writer->raw(bt->type_name());
     }
+    writer->raw("\",", 2).newline();
 
     //Attributes
-    transform(strm, bt->get_attr_table(), indent);
-    *strm << "," << endl;
+    transform(writer, bt->get_attr_table(), indent);
+    writer->raw(',').newline();
 
 }
 
@@ -278,9 +379,28 @@ void FoDapJsonTransform::writeLeafMetadata(ostream *strm, libdap::BaseType *bt,
  * @param dds DDS object
  * @throws BESInternalError if the DDS* is null or if localfile is empty.
  */
-FoDapJsonTransform::FoDapJsonTransform(libdap::DDS *dds) : _dds(dds), _indent_increment("  ")
+FoDapJsonTransform::FoDapJsonTransform(libdap::DDS *dds) : _dds(dds), _eval(0), _slab_bytes(0), _release_data(false),
+    _threads(1)
 {
     if (!_dds) throw BESInternalError("File out JSON, null DDS passed to constructor", __FILE__, __LINE__);
+
+    set_compact(false);
+}
+
+/**
+ * @brief Select compact or pretty-printed output
+ *
+ * Compact output has no indentation, newlines or spaces after the ':' and
+ * ',' separators. Pretty-printed output, the default, is indented with
+ * one property or value per line.
+ *
+ * @param compact True for compact output
+ */
+void FoDapJsonTransform::set_compact(bool compact)
+{
+    _compact = compact;
+    _indents.clear();
+    _indent_increment = compact ? "" : "  ";
 }
 
 /** @brief dumps information about this transformation object for debugging
@@ -318,14 +438,63 @@ void FoDapJsonTransform::dump(ostream &strm) const
  */
 void FoDapJsonTransform::transform(ostream &ostrm, bool sendData)
 {
-    transform(&ostrm, _dds, "", sendData);
+    fojson::JsonWriter writer(ostrm, _compact);
+
+    transform(&writer, _dds, "", sendData);
+
+    writer.flush();
+}
+
+/**
+ * @brief The exact size, in bytes, of the response transform() will write
+ *
+ * The length of the values of arrays is worked out from the values (see
+ * fojson::values_size()) and the rest of the response is counted as it is
+ * written to a stream that keeps none of it. The values must have been
+ * read already; they are neither read nor freed here.
+ *
+ * @param sendData True for the data response, false for the metadata
+ * response
+ * @param bytes Set to the size
+ * @return False, and bytes is not set, for a data response whose variables
+ * are read as they are written or that holds a Sequence, whose rows are
+ * only read as they are written
+ */
+bool FoDapJsonTransform::size(bool sendData, uint64_t &bytes)
+{
+    if (sendData && (_eval || fojson::has_sequence(_dds))) return false;
+
+    fojson::CountingStreambuf counted;
+    ostream strm(&counted);
+    fojson::JsonWriter writer(strm, _compact, fojson::JsonWriter::sizing_buffer_size);
+    writer.set_sizing(true);
+
+    // Sized on this thread, keeping the values for the response itself
+    unsigned int threads = _threads;
+    bool release_data = _release_data;
+    _threads = 1;
+    _release_data = false;
+    try {
+        transform(&writer, _dds, "", sendData);
+    }
+    catch (...) {
+        _threads = threads;
+        _release_data = release_data;
+        throw;
+    }
+    _threads = threads;
+    _release_data = release_data;
+
+    writer.flush();
+    bytes = counted.count() + writer.sized();
+    return true;
 }
 
 /**
  * DAP Constructor types are semantically equivalent to a w10n node type so they
  * must be represented as a collection of child nodes and leaves.
  */
-void FoDapJsonTransform::transform(ostream *strm, libdap::Constructor *cnstrctr, string indent, bool sendData)
+void FoDapJsonTransform::transform(fojson::JsonWriter *writer, libdap::Constructor *cnstrctr, const string &indent, bool sendData)
 {
     vector<libdap::BaseType *> leaves;
     vector<libdap::BaseType *> nodes;
@@ -351,15 +520,15 @@ void FoDapJsonTransform::transform(ostream *strm, libdap::Constructor *cnstrctr,
     }
 
     // Declare this node
-    *strm << indent << "{" << endl;
-    string child_indent = indent + _indent_increment;
+    writer->raw(indent).raw('{').newline();
+    const string &child_indent = next_indent(indent);
 
     // Write this node's metadata (name & attributes)
-    writeNodeMetadata(strm, cnstrctr, child_indent);
+    writeNodeMetadata(writer, cnstrctr, child_indent);
 
-    transform_node_worker(strm, leaves, nodes, child_indent, sendData);
+    transform_node_worker(writer, leaves, nodes, child_indent, sendData);
 
-    *strm << indent << "}" << endl;
+    writer->raw(indent).raw('}').newline();
 
 }
 
@@ -367,41 +536,30 @@ void FoDapJsonTransform::transform(ostream *strm, libdap::Constructor *cnstrctr,
  * This worker method allows us to recursively traverse a "node" variables contents and
  * any child nodes will be traversed as well.
  */
-void FoDapJsonTransform::transform_node_worker(ostream *strm, vector<libdap::BaseType *> leaves,
-    vector<libdap::BaseType *> nodes, string indent, bool sendData)
+void FoDapJsonTransform::transform_node_worker(fojson::JsonWriter *writer, const vector<libdap::BaseType *> &leaves,
+    const vector<libdap::BaseType *> &nodes, const string &indent, bool sendData)
 {
     // Write down this nodes leaves
-    *strm << indent << "\"leaves\": [";
-    if (leaves.size() > 0) *strm << endl;
-    for (std::vector<libdap::BaseType *>::size_type l = 0; l < leaves.size(); l++) {
-        libdap::BaseType *v = leaves[l];
-        BESDEBUG(FoDapJsonTransform_debug_key, "Processing LEAF: " << v->name() << endl);
-        if (l > 0) {
-            *strm << ",";
-            *strm << endl;
-        }
-        transform(strm, v, indent + _indent_increment, sendData);
-    }
-    if (leaves.size() > 0) *strm << endl << indent;
-    *strm << "]," << endl;
+    writer->raw(indent).key("leaves").raw('[');
+    if (leaves.size() > 0) writer->newline();
+    fojson::VariableWriter<FoDapJsonTransform>::write(*this, writer, leaves, next_indent(indent), sendData, true);
+    if (leaves.size() > 0) writer->newline().raw(indent);
+    writer->raw("],", 2).newline();
 
     // Write down this nodes child nodes
-    *strm << indent << "\"nodes\": [";
-    if (nodes.size() > 0) *strm << endl;
-    for (std::vector<libdap::BaseType *>::size_type n = 0; n < nodes.size(); n++) {
-        libdap::BaseType *v = nodes[n];
-        transform(strm, v, indent + _indent_increment, sendData);
-    }
-    if (nodes.size() > 0) *strm << endl << indent;
+    writer->raw(indent).key("nodes").raw('[');
+    if (nodes.size() > 0) writer->newline();
+    fojson::VariableWriter<FoDapJsonTransform>::write(*this, writer, nodes, next_indent(indent), sendData, false);
+    if (nodes.size() > 0) writer->newline().raw(indent);
 
-    *strm << "]" << endl;
+    writer->raw(']').newline();
 }
 
 /**
  * Writes a JSON representation of the DDS to the passed stream. Data is sent is the sendData
  * flag is true.
  */
-void FoDapJsonTransform::transform(ostream *strm, libdap::DDS *dds, string indent, bool sendData)
+void FoDapJsonTransform::transform(fojson::JsonWriter *writer, libdap::DDS *dds, const string &indent, bool sendData)
 {
     /**
      * w10 sees the world in terms of leaves and nodes. Leaves have data, nodes have other nodes and leaves.
@@ -428,22 +586,22 @@ void FoDapJsonTransform::transform(ostream *strm, libdap::DDS *dds, string inden
     }
 
     // Declare this node
-    *strm << indent << "{" << endl;
-    string child_indent = indent + _indent_increment;
+    writer->raw(indent).raw('{').newline();
+    const string &child_indent = next_indent(indent);
 
     // Write this node's metadata (name & attributes)
-    writeDatasetMetadata(strm, dds, child_indent);
+    writeDatasetMetadata(writer, dds, child_indent);
 
-    transform_node_worker(strm, leaves, nodes, child_indent, sendData);
+    transform_node_worker(writer, leaves, nodes, child_indent, sendData);
 
-    *strm << indent << "}" << endl;
+    writer->raw(indent).raw('}').newline();
 }
 
 /**
  * Write the json representation of the passed BAseType instance. If the
  * parameter sendData is true then include the data.
  */
-void FoDapJsonTransform::transform(ostream *strm, libdap::BaseType *bt, string indent, bool sendData)
+void FoDapJsonTransform::transform(fojson::JsonWriter *writer, libdap::BaseType *bt, const string &indent, bool sendData)
 {
     switch (bt->type()) {
     // Handle the atomic types - that's easy!
@@ -456,23 +614,23 @@ void FoDapJsonTransform::transform(ostream *strm, libdap::BaseType *bt, string i
     case libdap::dods_float64_c:
     case libdap::dods_str_c:
     case libdap::dods_url_c:
-        transformAtomic(strm, bt, indent, sendData);
+        transformAtomic(writer, bt, indent, sendData);
         break;
 
     case libdap::dods_structure_c:
-        transform(strm, (libdap::Structure *) bt, indent, sendData);
+        transform(writer, (libdap::Structure *) bt, indent, sendData);
         break;
 
     case libdap::dods_grid_c:
-        transform(strm, (libdap::Grid *) bt, indent, sendData);
+        transform(writer, (libdap::Grid *) bt, indent, sendData);
         break;
 
     case libdap::dods_sequence_c:
-        transform(strm, (libdap::Sequence *) bt, indent, sendData);
+        transform(writer, (libdap::Sequence *) bt, indent, sendData);
         break;
 
     case libdap::dods_array_c:
-        transform(strm, (libdap::Array *) bt, indent, sendData);
+        transform(writer, (libdap::Array *) bt, indent, sendData);
         break;
 
     case libdap::dods_int8_c:
@@ -500,31 +658,26 @@ void FoDapJsonTransform::transform(ostream *strm, libdap::BaseType *bt, string i
  * Write the json representation of the passed BaseType instance - which had better be one of the
  * atomic DAP types. If the parameter sendData is true then include the data.
  */
-void FoDapJsonTransform::transformAtomic(ostream *strm, libdap::BaseType *b, string indent, bool sendData)
+void FoDapJsonTransform::transformAtomic(fojson::JsonWriter *writer, libdap::BaseType *b, const string &indent, bool sendData)
 {
 
-    *strm << indent << "{" << endl;
+    writer->raw(indent).raw('{').newline();
 
-    string childindent = indent + _indent_increment;
+    const string &childindent = next_indent(indent);
 
-    writeLeafMetadata(strm, b, childindent);
+    writeLeafMetadata(writer, b, childindent);
 
-    *strm << childindent << "\"shape\": [1]," << endl;
+    writer->raw(childindent).key("shape").raw("[1],", 4).newline();
 
     if (sendData) {
         // Data
-        *strm << childindent << "\"data\": [";
+        writer->raw(childindent).key("data").raw('[');
 
-        if (b->type() == libdap::dods_str_c || b->type() == libdap::dods_url_c) {
-            libdap::Str *strVar = (libdap::Str *) b;
-            std::string tmpString = strVar->value();
-            *strm << "\"" << fojson::escape_for_json(tmpString) << "\"";
-        }
-        else {
-            b->print_val(*strm, "", false);
-        }
+        _value_format.precision = _precision_spec.get_precision(b);
+        read_data(writer, b);
+        fojson::write_value(writer, b, _value_format);
 
-        *strm << "]";
+        writer->raw(']');
     }
 
 }
@@ -533,7 +686,7 @@ void FoDapJsonTransform::transformAtomic(ostream *strm, libdap::BaseType *b, str
  * Write the json representation of the passed DAP Array instance - which had better be one of
  * atomic DAP types. If the parameter sendData is true then include the data.
  */
-void FoDapJsonTransform::transform(ostream *strm, libdap::Array *a, string indent, bool sendData)
+void FoDapJsonTransform::transform(fojson::JsonWriter *writer, libdap::Array *a, const string &indent, bool sendData)
 {
 
     BESDEBUG(FoDapJsonTransform_debug_key,
@@ -542,40 +695,40 @@ void FoDapJsonTransform::transform(ostream *strm, libdap::Array *a, string inden
     switch (a->var()->type()) {
     // Handle the atomic types - that's easy!
     case libdap::dods_byte_c:
-        json_simple_type_array<libdap::dods_byte>(strm, a, indent, sendData);
+        json_simple_type_array<libdap::dods_byte>(writer, a, indent, sendData);
         break;
 
     case libdap::dods_int16_c:
-        json_simple_type_array<libdap::dods_int16>(strm, a, indent, sendData);
+        json_simple_type_array<libdap::dods_int16>(writer, a, indent, sendData);
         break;
 
     case libdap::dods_uint16_c:
-        json_simple_type_array<libdap::dods_uint16>(strm, a, indent, sendData);
+        json_simple_type_array<libdap::dods_uint16>(writer, a, indent, sendData);
         break;
 
     case libdap::dods_int32_c:
-        json_simple_type_array<libdap::dods_int32>(strm, a, indent, sendData);
+        json_simple_type_array<libdap::dods_int32>(writer, a, indent, sendData);
         break;
 
     case libdap::dods_uint32_c:
-        json_simple_type_array<libdap::dods_uint32>(strm, a, indent, sendData);
+        json_simple_type_array<libdap::dods_uint32>(writer, a, indent, sendData);
         break;
 
     case libdap::dods_float32_c:
-        json_simple_type_array<libdap::dods_float32>(strm, a, indent, sendData);
+        json_simple_type_array<libdap::dods_float32>(writer, a, indent, sendData);
         break;
 
     case libdap::dods_float64_c:
-        json_simple_type_array<libdap::dods_float64>(strm, a, indent, sendData);
+        json_simple_type_array<libdap::dods_float64>(writer, a, indent, sendData);
         break;
 
     case libdap::dods_str_c: {
-        json_string_array(strm, a, indent, sendData);
+        json_string_array(writer, a, indent, sendData);
         break;
     }
 
     case libdap::dods_url_c: {
-        json_string_array(strm, a, indent, sendData);
+        json_string_array(writer, a, indent, sendData);
         break;
     }
 
@@ -621,20 +774,20 @@ void FoDapJsonTransform::transform(ostream *strm, libdap::Array *a, string inden
  * Write the json representation of the passed DAP AttrTable instance.
  * Supports multi-valued attributes and nested attributes.
  */
-void FoDapJsonTransform::transform(ostream *strm, libdap::AttrTable &attr_table, string indent)
+void FoDapJsonTransform::transform(fojson::JsonWriter *writer, libdap::AttrTable &attr_table, const string &indent)
 {
 
-    string child_indent = indent + _indent_increment;
+    const string &child_indent = next_indent(indent);
 
     // Start the attributes block
-    *strm << indent << "\"attributes\": [";
+    writer->raw(indent).key("attributes").raw('[');
 
 //	if(attr_table.get_name().length()>0)
 //		*strm  << endl << child_indent << "{\"name\": \"name\", \"value\": \"" << attr_table.get_name() << "\"},";
 
 // Only do more if there are actually attributes in the table
     if (attr_table.get_size() != 0) {
-        *strm << endl;
+        writer->newline();
         libdap::AttrTable::Attr_iter begin = attr_table.attr_begin();
         libdap::AttrTable::Attr_iter end = attr_table.attr_end();
 
@@ -645,65 +798,62 @@ void FoDapJsonTransform::transform(ostream *strm, libdap::AttrTable &attr_table,
                 libdap::AttrTable *atbl = attr_table.get_attr_table(at_iter);
 
                 // not first thing? better use a comma...
-                if (at_iter != begin) *strm << "," << endl;
+                if (at_iter != begin) writer->raw(',').newline();
 
                 // Attribute Containers need to be opened and then a recursive call gets made
-                *strm << child_indent << "{" << endl;
+                writer->raw(child_indent).raw('{').newline();
 
                 // If the table has a name, write it out as a json property.
                 if (atbl->get_name().length() > 0)
-                    *strm << child_indent + _indent_increment << "\"name\": \"" << atbl->get_name() << "\"," << endl;
+                    writer->raw(child_indent).raw(_indent_increment).key("name").raw(quoted_name(atbl)).raw(',').newline();
 
                 // Recursive call for child attribute table.
-                transform(strm, *atbl, child_indent + _indent_increment);
-                *strm << endl << child_indent << "}";
+                transform(writer, *atbl, next_indent(child_indent));
+                writer->newline().raw(child_indent).raw('}');
 
                 break;
 
             }
             default: {
                 // not first thing? better use a comma...
-                if (at_iter != begin) *strm << "," << endl;
+                if (at_iter != begin) writer->raw(',').newline();
 
                 // Open attribute object, write name
-                *strm << child_indent << "{\"name\": \"" << attr_table.get_name(at_iter) << "\", ";
+                writer->raw(child_indent).raw('{').key("name").raw(quoted_name(attr_table, at_iter)).separator();
 
                 // Open value array
-                *strm << "\"value\": [";
+                writer->key("value").raw('[');
                 vector<std::string> *values = attr_table.get_attr_vector(at_iter);
                 // write values
                 for (std::vector<std::string>::size_type i = 0; i < values->size(); i++) {
 
                     // not first thing? better use a comma...
-                    if (i > 0) *strm << ",";
+                    if (i > 0) writer->raw(',');
 
                     // Escape the double quotes found in String and URL type attribute values.
                     if (attr_table.get_attr_type(at_iter) == libdap::Attr_string
                         || attr_table.get_attr_type(at_iter) == libdap::Attr_url) {
-                        *strm << "\"";
-                        // string value = (*values)[i] ;
-                        *strm << fojson::escape_for_json((*values)[i]);
-                        *strm << "\"";
+                        writer->quoted((*values)[i]);
                     }
                     else {
 
-                        *strm << (*values)[i];
+                        writer->raw((*values)[i]);
                     }
 
                 }
                 // close value array
-                *strm << "]}";
+                writer->raw("]}", 2);
                 break;
             }
 
             }
         }
 
-        *strm << endl << indent;
+        writer->newline().raw(indent);
     }
 
     // close AttrTable JSON
 
-    *strm << "]";
+    writer->raw(']');
 }
 
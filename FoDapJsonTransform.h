@@ -32,9 +32,15 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <deque>
+
+#include <AttrTable.h>
 
 #include <BESObj.h>
 
+#include "fojson_utils.h"
+#include "fojson_format.h"
+
 namespace libdap {
 class BaseType;
 class DDS;
@@ -43,6 +49,11 @@ class Array;
 
 class BESDataHandlerInterface;
 
+namespace fojson {
+class JsonWriter;
+template<class Transform> class VariableWriter;
+}
+
 /**
  * Used to transform a DDS into a w10n JSON metadata or w10n JSON data document.
  * The output is written to a local file whose name is passed as a parameter
@@ -54,33 +65,91 @@ private:
     std::string _returnAs;
     std::string _indent_increment;
 
-    void writeNodeMetadata(std::ostream *strm, libdap::BaseType *bt, std::string indent);
-    void writeLeafMetadata(std::ostream *strm, libdap::BaseType *bt, std::string indent);
-    void writeDatasetMetadata(std::ostream *strm, libdap::DDS *dds, std::string indent);
+    // The indent of each depth, made the first time it is needed
+    std::deque<std::string> _indents;
+
+    // True to write the response without whitespace
+    bool _compact;
+
+    // Escaped and quoted names of the variables and attributes written so far
+    std::map<const void *, std::string> _quoted_names;
+
+    // Significant digits for Float32 and Float64 values, by variable
+    fojson::PrecisionSpec _precision_spec;
+
+    // How values are written: the precision of the variable being written
+    // and the text used for NaN and Inf
+    fojson::ValueFormat _value_format;
+
+    // When not null the variables are read as they are written with this
+    libdap::ConstraintEvaluator *_eval;
+
+    // Arrays read as they are written that are larger than this are read
+    // in slabs of about this size; 0 reads them whole
+    size_t _slab_bytes;
+
+    // True to free each top level variable's values once it is written
+    bool _release_data;
+
+    // Top level variables whose values have been read are written on this
+    // many threads
+    unsigned int _threads;
+
+    // Writes lists of variables, on those threads when it can
+    friend class fojson::VariableWriter<FoDapJsonTransform>;
+
+    // Make sure bt's values have been read before they are written
+    void read_data(fojson::JsonWriter *writer, libdap::BaseType *bt)
+    {
+        if (_eval) fojson::read_variable(writer, bt, *_eval, *_dds);
+    }
+
+    // Free the values of a top level variable once it has been written; those
+    // read as they are written are always freed
+    void release_written(libdap::BaseType *bt)
+    {
+        if ((_release_data || _eval) && !bt->get_parent()) bt->clear_local_data();
+    }
 
-    void transformAtomic(std::ostream *strm, libdap::BaseType *bt, std::string indent, bool sendData);
+    const std::string &next_indent(const std::string &indent);
 
-    void transform(std::ostream *strm, libdap::DDS *dds, std::string indent, bool sendData);
-    void transform(std::ostream *strm, libdap::BaseType *bt, std::string indent, bool sendData);
+    const std::string &quoted_name(libdap::BaseType *bt);
+    const std::string &quoted_name(libdap::AttrTable *atbl);
+    const std::string &quoted_name(libdap::AttrTable &attr_table, libdap::AttrTable::Attr_iter at_iter);
+
+    void writeNodeMetadata(fojson::JsonWriter *writer, libdap::BaseType *bt, const std::string &indent);
+    void writeLeafMetadata(fojson::JsonWriter *writer, libdap::BaseType *bt, const std::string &indent);
+    void writeDatasetMetadata(fojson::JsonWriter *writer, libdap::DDS *dds, const std::string &indent);
+
+    void transformAtomic(fojson::JsonWriter *writer, libdap::BaseType *bt, const std::string &indent, bool sendData);
+
+    void transform(fojson::JsonWriter *writer, libdap::DDS *dds, const std::string &indent, bool sendData);
+    void transform(fojson::JsonWriter *writer, libdap::BaseType *bt, const std::string &indent, bool sendData);
 
     //void transform(std::ostream *strm, Structure *s,string indent );
     //void transform(std::ostream *strm, Grid *g, string indent);
     //void transform(std::ostream *strm, Sequence *s, string indent);
-    void transform(std::ostream *strm, libdap::Constructor *cnstrctr, std::string indent, bool sendData);
-    void transform_node_worker(std::ostream *strm, std::vector<libdap::BaseType *> leaves,
-        std::vector<libdap::BaseType *> nodes, std::string indent, bool sendData);
+    void transform(fojson::JsonWriter *writer, libdap::Constructor *cnstrctr, const std::string &indent, bool sendData);
+    void transform_node_worker(fojson::JsonWriter *writer, const std::vector<libdap::BaseType *> &leaves,
+        const std::vector<libdap::BaseType *> &nodes, const std::string &indent, bool sendData);
+
+    void writeShape(fojson::JsonWriter *writer, const std::vector<unsigned int> &shape, const std::string &indent);
 
-    void transform(std::ostream *strm, libdap::Array *a, std::string indent, bool sendData);
-    void transform(std::ostream *strm, libdap::AttrTable &attr_table, std::string indent);
+    void transform(fojson::JsonWriter *writer, libdap::Array *a, const std::string &indent, bool sendData);
+    void transform(fojson::JsonWriter *writer, libdap::AttrTable &attr_table, const std::string &indent);
 
     template<typename T>
-    void json_simple_type_array(std::ostream *strm, libdap::Array *a, std::string indent, bool sendData);
+    void json_simple_type_array(fojson::JsonWriter *writer, libdap::Array *a, const std::string &indent, bool sendData);
 
-    void json_string_array(std::ostream *strm, libdap::Array *a, std::string indent, bool sendData);
+    void json_string_array(fojson::JsonWriter *writer, libdap::Array *a, const std::string &indent, bool sendData);
 
     template<typename T>
-    unsigned int json_simple_type_array_worker(std::ostream *strm, T *values, unsigned int indx,
+    uint64_t json_simple_type_array_worker(fojson::JsonWriter *writer, const T *values, uint64_t indx,
         std::vector<unsigned int> *shape, unsigned int currentDim);
+
+    template<typename T>
+    uint64_t json_simple_type_array_slabs(fojson::JsonWriter *writer, libdap::Array *a,
+        std::vector<unsigned int> *shape, unsigned int slab_rows);
 public:
     FoDapJsonTransform(libdap::DDS *dds);
 
@@ -88,6 +157,28 @@ public:
 
     virtual void transform(std::ostream &ostrm, bool sendData);
 
+    virtual bool size(bool sendData, uint64_t &bytes);
+
+    /// Set the JSON text written in place of NaN and Inf values
+    virtual void set_non_finite_as(const std::string &non_finite_as) { _value_format.non_finite = non_finite_as; }
+
+    /// Set the number of significant digits written for Float32 and Float64 variables
+    virtual void set_precision(const fojson::PrecisionSpec &precision_spec) { _precision_spec = precision_spec; }
+
+    virtual void set_compact(bool compact);
+
+    /// Read each variable just before it is written, using this evaluator
+    virtual void set_read_as_written(libdap::ConstraintEvaluator *eval) { _eval = eval; }
+
+    /// Read large Arrays in slabs of about this many bytes when they are read as written
+    virtual void set_slab_bytes(size_t slab_bytes) { _slab_bytes = slab_bytes; }
+
+    /// Free each variable's values as soon as it has been written
+    virtual void set_release_data(bool release_data) { _release_data = release_data; }
+
+    /// Write top level variables on this many threads when their values have been read
+    virtual void set_threads(unsigned int threads) { _threads = threads; }
+
     virtual void dump(std::ostream &strm) const;
 };
 
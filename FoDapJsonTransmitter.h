@@ -31,8 +31,11 @@
 
 #include <BESBasicTransmitter.h>
 
+#include "fojson_utils.h"
+
 class BESResponseObject;
 class BESDataHandlerInterface;
+class FoDapJsonTransform;
 
 /** @brief BESTransmitter class named "json" that transmits an OPeNDAP
  * data object as a JSON file
@@ -45,7 +48,7 @@ class BESDataHandlerInterface;
  */
 class FoDapJsonTransmitter: public BESBasicTransmitter {
 private:
-    static string temp_dir;
+    static void transmit(FoDapJsonTransform &ft, std::ostream &o_strm, BESDataHandlerInterface &dhi, bool sendData);
 
 public:
     FoDapJsonTransmitter();
@@ -30,6 +30,7 @@
 
 #include <cassert>
 
+#include <algorithm>
 #include <sstream>
 #include <iostream>
 #include <fstream>
@@ -51,6 +52,9 @@
 
 #include "FoInstanceJsonTransform.h"
 #include "fojson_utils.h"
+#include "fojson_format.h"
+#include "JsonWriter.h"
+#include "VariableWriter.h"
 
 using namespace std;
 
@@ -58,74 +62,175 @@ using namespace std;
 #define JSON_ORIGINAL_NAME "json_original_name"
 
 #define FoInstanceJsonTransform_debug_key "fojson"
-const int int_64_precision = 15; // See also in FODapJsonTransform.cc. jhrg 9/14/15
 
 /**
- * Writes out the values of an n-dimensional array. Uses recursion.
+ * Writes out the values of an n-dimensional array. Uses recursion; the values
+ * of the innermost dimension are contiguous and are written in one go.
  */
 template<typename T>
-unsigned int FoInstanceJsonTransform::json_simple_type_array_worker(std::ostream *strm,
-    const std::vector<T> &values, unsigned int indx, const std::vector<unsigned int> &shape, unsigned int currentDim)
+uint64_t FoInstanceJsonTransform::json_simple_type_array_worker(fojson::JsonWriter *writer,
+    const T *values, uint64_t indx, const std::vector<unsigned int> &shape, unsigned int currentDim)
 {
-    *strm << "[";
+    writer->raw('[');
 
     unsigned int currentDimSize = shape.at(currentDim);        // at is slower than [] but safe
 
-    for (unsigned int i = 0; i < currentDimSize; i++) {
-        if (currentDim < shape.size() - 1) {
+    if (currentDim < shape.size() - 1) {
+        for (unsigned int i = 0; i < currentDimSize; i++) {
             BESDEBUG(FoInstanceJsonTransform_debug_key,
                 "json_simple_type_array_worker() - Recursing! indx:  " << indx << " currentDim: " << currentDim << " currentDimSize: " << currentDimSize << endl);
 
-            indx = json_simple_type_array_worker<T>(strm, values, indx, shape, currentDim + 1);
-            if (i + 1 != currentDimSize) *strm << ", ";
+            indx = json_simple_type_array_worker<T>(writer, values, indx, shape, currentDim + 1);
+            if (i + 1 != currentDimSize) writer->separator();
         }
-        else {
-            if (i) *strm << ", ";
-            *strm << values[indx++];
+    }
+    else {
+        writer->checkpoint();
+        fojson::write_values(writer, values + indx, currentDimSize, _value_format);
+        indx += currentDimSize;
+    }
+
+    writer->raw(']');
+
+    return indx;
+}
+
+/**
+ * Writes the values of a large Array that has not been read yet, reading it
+ * a slab of rows of its outermost dimension at a time. Only one slab is in
+ * memory at once. The output is the same as json_simple_type_array_worker()
+ * writes for the whole Array.
+ */
+template<typename T>
+uint64_t FoInstanceJsonTransform::json_simple_type_array_slabs(fojson::JsonWriter *writer, libdap::Array *a,
+    const std::vector<unsigned int> &shape, unsigned int slab_rows)
+{
+    unsigned int rows = shape[0];
+    uint64_t row_values = fojson::row_size(shape);
+    uint64_t indx = 0;
+
+    writer->raw('[');
+
+    for (unsigned int first = 0; first < rows; first += slab_rows) {
+        unsigned int n = std::min(slab_rows, rows - first);
+
+        // Send what has been written while the slab is read
+        writer->flush();
+        libdap::Array *slab = fojson::read_slab(a, first, n);
+        try {
+            if ((uint64_t) slab->length() < n * row_values)
+                throw BESInternalError("File out JSON, a slab of Array " + a->name() + " holds fewer values than its shape.",
+                    __FILE__, __LINE__);
+            const T *values = reinterpret_cast<const T *>(slab->get_buf());
+
+            if (shape.size() == 1) {
+                if (first) writer->separator();
+                writer->checkpoint();
+                fojson::write_values(writer, values, n, _value_format);
+            }
+            else {
+                for (unsigned int i = 0; i < n; i++) {
+                    if (first + i) writer->separator();
+                    json_simple_type_array_worker<T>(writer, values, i * row_values, shape, 1);
+                }
+            }
         }
+        catch (...) {
+            delete slab;
+            throw;
+        }
+        delete slab;
+
+        indx += n * row_values;
     }
 
-    *strm << "]";
+    writer->raw(']');
 
     return indx;
 }
 
+/**
+ * Return the indent one level deeper than indent. Each depth's indent is
+ * made once and reused for the rest of the response, so writing a variable
+ * or attribute does not build new indent strings.
+ */
+const std::string &FoInstanceJsonTransform::next_indent(const std::string &indent)
+{
+    if (_indent_increment.empty()) return indent;
+
+    std::deque<std::string>::size_type depth = indent.length() / _indent_increment.length() + 1;
+    while (_indents.size() <= depth)
+        _indents.push_back(_indents.empty() ? std::string() : _indents.back() + _indent_increment);
+
+    return _indents[depth];
+}
+
+/** @name quoted_name
+ * Return the name of a variable, attribute table or attribute, escaped and
+ * enclosed in double quotes. The quoted name is computed the first time it
+ * is needed and then reused for the rest of the response; in a Sequence the
+ * same column names are written for every row.
+ */
+///@{
+const std::string &FoInstanceJsonTransform::quoted_name(libdap::BaseType *bt)
+{
+    std::map<const void *, std::string>::iterator i = _quoted_names.find(bt);
+    if (i == _quoted_names.end()) i = _quoted_names.insert(make_pair(bt, fojson::quote_for_json(bt->name()))).first;
+
+    return i->second;
+}
+
+const std::string &FoInstanceJsonTransform::quoted_name(libdap::AttrTable *atbl)
+{
+    std::map<const void *, std::string>::iterator i = _quoted_names.find(atbl);
+    if (i == _quoted_names.end()) i = _quoted_names.insert(make_pair(atbl, fojson::quote_for_json(atbl->get_name()))).first;
+
+    return i->second;
+}
+
+const std::string &FoInstanceJsonTransform::quoted_name(libdap::AttrTable &attr_table, libdap::AttrTable::Attr_iter at_iter)
+{
+    std::map<const void *, std::string>::iterator i = _quoted_names.find(*at_iter);
+    if (i == _quoted_names.end())
+        i = _quoted_names.insert(make_pair(*at_iter, fojson::quote_for_json(attr_table.get_name(at_iter)))).first;
+
+    return i->second;
+}
+///@}
+
 /**
  * @brief Writes out (in a JSON instance object representation) the metadata and data values for the passed array of simple types.
  *
- * @param strm Where to write stuff
+ * @param writer Where to write stuff
  * @param a The libdap::Array to write.
  * @param indent A string containing the indent level.
  * @param sendData A boolean value that when evaluated as true will cause the data values to be sent and not the metadata.
  */
-template<typename T> void FoInstanceJsonTransform::json_simple_type_array(std::ostream *strm, libdap::Array *a,
-    std::string indent, bool sendData)
+template<typename T> void FoInstanceJsonTransform::json_simple_type_array(fojson::JsonWriter *writer, libdap::Array *a,
+    const std::string &indent, bool sendData)
 {
-    std::string name = a->name();
-    *strm << indent << "\"" << fojson::escape_for_json(name) + "\":  ";
+    writer->raw(indent).raw(quoted_name(a)).colon().raw(_array_space);
 
     if (sendData) { // send data
         std::vector<unsigned int> shape(a->dimensions(true));
-        long length = fojson::computeConstrainedShape(a, &shape);
-
-        vector<T> src(length);
-        a->value(&src[0]);
+        uint64_t length = fojson::computeConstrainedShape(a, &shape);
 
-        unsigned int indx = 0;
+        _value_format.precision = _precision_spec.get_precision(a);
+        uint64_t indx;
 
-        if (typeid(T) == typeid(libdap::dods_float64)) {
-            streamsize prec = strm->precision(int_64_precision);
-            try {
-                indx = json_simple_type_array_worker(strm, src, 0, shape, 0);
-                strm->precision(prec);
-            }
-            catch (...) {
-                strm->precision(prec);
-                throw;
-            }
+        unsigned int slab_rows = fojson::slab_rows(a, shape, sizeof(T), _slab_bytes);
+        if (slab_rows) {
+            indx = json_simple_type_array_slabs<T>(writer, a, shape, slab_rows);
         }
         else {
-            indx = json_simple_type_array_worker(strm, src, 0, shape, 0);
+            // Format the values straight from the Array's own buffer
+            read_data(writer, a);
+            if ((uint64_t) a->length() < length)
+                throw BESInternalError("File out JSON, Array " + a->name() + " holds fewer values than its constrained shape.",
+                    __FILE__, __LINE__);
+            const T *src = reinterpret_cast<const T *>(a->get_buf());
+
+            indx = json_simple_type_array_worker(writer, src, 0, shape, 0);
         }
 
         // make this an assert?
@@ -137,10 +242,10 @@ template<typename T> void FoInstanceJsonTransform::json_simple_type_array(std::o
 #endif
     }
     else { // otherwise send metadata
-        *strm << "{" << endl;
+        writer->raw('{').newline();
         //Attributes
-        transform(strm, a->get_attr_table(), indent + _indent_increment);
-        *strm << endl << indent << "}";
+        transform(writer, a->get_attr_table(), next_indent(indent));
+        writer->newline().raw(indent).raw('}');
     }
 }
 
@@ -148,25 +253,28 @@ template<typename T> void FoInstanceJsonTransform::json_simple_type_array(std::o
  * String version of json_simple_type_array(). This version exists because of the differing
  * type signatures of the libdap::Vector::value() methods for numeric and c++ string types.
  *
- * @param strm Write to this stream
+ * @param writer Write here
  * @param a Source Array - write out data or metadata from or about this Array
  * @param indent Indent the output so humans can make sense of it
  * @param sendData True: send data; false: send metadata
  */
-void FoInstanceJsonTransform::json_string_array(std::ostream *strm, libdap::Array *a, std::string indent, bool sendData)
+void FoInstanceJsonTransform::json_string_array(fojson::JsonWriter *writer, libdap::Array *a, const std::string &indent, bool sendData)
 {
-    std::string name = a->name();
-    *strm << indent << "\"" << fojson::escape_for_json(name) + "\":  ";
+    writer->raw(indent).raw(quoted_name(a)).colon().raw(_array_space);
 
     if (sendData) { // send data
         std::vector<unsigned int> shape(a->dimensions(true));
-        long length = fojson::computeConstrainedShape(a, &shape);
+        uint64_t length = fojson::computeConstrainedShape(a, &shape);
 
-        // The string type utilizes a specialized version of libdap::Array::value()
-        std::vector<std::string> sourceValues;
-        a->value(sourceValues);
+        // Write the strings from the Array's own storage; they are escaped
+        // straight into the writer
+        read_data(writer, a);
+        const std::vector<std::string> &values = a->get_str();
+        if ((uint64_t) values.size() < length)
+            throw BESInternalError("File out JSON, Array " + a->name() + " holds fewer values than its constrained shape.",
+                __FILE__, __LINE__);
 
-        unsigned int indx = json_simple_type_array_worker(strm, sourceValues, 0, shape, 0);
+        uint64_t indx = json_simple_type_array_worker(writer, length ? &values[0] : 0, 0, shape, 0);
 
         // make this an assert?
         if (length != indx)
@@ -174,10 +282,10 @@ void FoInstanceJsonTransform::json_string_array(std::ostream *strm, libdap::Arra
                 "json_string_array() - indx NOT equal to content length! indx:  " << indx << "  length: " << length << endl);
     }
     else { // otherwise send metadata
-        *strm << "{" << endl;
+        writer->raw('{').newline();
         //Attributes
-        transform(strm, a->get_attr_table(), indent + _indent_increment);
-        *strm << endl << indent << "}";
+        transform(writer, a->get_attr_table(), next_indent(indent));
+        writer->newline().raw(indent).raw('}');
     }
 }
 
@@ -218,9 +326,29 @@ FoInstanceJsonTransform::FoInstanceJsonTransform(libdap::DDS *dds, BESDataHandle
  * @param dhi
  * @param ostrm
  */
-FoInstanceJsonTransform::FoInstanceJsonTransform(libdap::DDS *dds):  _dds(dds), _indent_increment(" ")
+FoInstanceJsonTransform::FoInstanceJsonTransform(libdap::DDS *dds):  _dds(dds), _eval(0), _slab_bytes(0), _release_data(false),
+    _threads(1)
 {
     if (!_dds) throw BESInternalError("File out JSON, null DDS passed to constructor", __FILE__, __LINE__);
+
+    set_compact(false);
+}
+
+/**
+ * @brief Select compact or pretty-printed output
+ *
+ * Compact output has no indentation, newlines or spaces after the ':' and
+ * ',' separators. Pretty-printed output, the default, is indented with
+ * one property or value per line.
+ *
+ * @param compact True for compact output
+ */
+void FoInstanceJsonTransform::set_compact(bool compact)
+{
+    _compact = compact;
+    _indents.clear();
+    _indent_increment = compact ? "" : " ";
+    _array_space = compact ? "" : " ";
 }
 
 /** @brief dumps information about this transformation object for debugging
@@ -256,7 +384,56 @@ void FoInstanceJsonTransform::dump(std::ostream &strm) const
  */
 void FoInstanceJsonTransform::transform(ostream &ostrm, bool sendData)
 {
-    transform(&ostrm, _dds, "", sendData);
+    fojson::JsonWriter writer(ostrm, _compact);
+
+    transform(&writer, _dds, "", sendData);
+
+    writer.flush();
+}
+
+/**
+ * @brief The exact size, in bytes, of the response transform() will write
+ *
+ * The length of the values of arrays is worked out from the values (see
+ * fojson::values_size()) and the rest of the response is counted as it is
+ * written to a stream that keeps none of it. The values must have been
+ * read already; they are neither read nor freed here.
+ *
+ * @param sendData True for the data response, false for the metadata
+ * response
+ * @param bytes Set to the size
+ * @return False, and bytes is not set, for a data response whose variables
+ * are read as they are written or that holds a Sequence, whose rows are
+ * only read as they are written
+ */
+bool FoInstanceJsonTransform::size(bool sendData, uint64_t &bytes)
+{
+    if (sendData && (_eval || fojson::has_sequence(_dds))) return false;
+
+    fojson::CountingStreambuf counted;
+    ostream strm(&counted);
+    fojson::JsonWriter writer(strm, _compact, fojson::JsonWriter::sizing_buffer_size);
+    writer.set_sizing(true);
+
+    // Sized on this thread, keeping the values for the response itself
+    unsigned int threads = _threads;
+    bool release_data = _release_data;
+    _threads = 1;
+    _release_data = false;
+    try {
+        transform(&writer, _dds, "", sendData);
+    }
+    catch (...) {
+        _threads = threads;
+        _release_data = release_data;
+        throw;
+    }
+    _threads = threads;
+    _release_data = release_data;
+
+    writer.flush();
+    bytes = counted.count() + writer.sized();
+    return true;
 }
 
 /** @brief Transforms the DDS object into a JSON instance object representation.
@@ -264,67 +441,49 @@ void FoInstanceJsonTransform::transform(ostream &ostrm, bool sendData)
  * Transforms the DDS and all of it's "projected" variables into a JSON document using
  * an instance object representation.
  *
- * @param strm Stream to which to write JSON.
+ * @param writer Write the JSON here.
  * @param dds The DDS to produce JSON from.
  * @param indent White space indent.
  * @param sendData If the sendData parameter is true data will be sent. If sendData is false then the metadata will be sent.
  */
-void FoInstanceJsonTransform::transform(std::ostream *strm, libdap::DDS *dds, string indent, bool sendData)
+void FoInstanceJsonTransform::transform(fojson::JsonWriter *writer, libdap::DDS *dds, const string &indent, bool sendData)
 {
-    bool sentSomething = false;
-
     // Open returned JSON object
-    *strm << "{" << endl;
+    writer->raw('{').newline();
 
     // Name object
-    std::string name = dds->get_dataset_name();
-    *strm << indent + _indent_increment << "\"name\": \"" << fojson::escape_for_json(name) << "\"," << endl;
+    writer->raw(indent).raw(_indent_increment).key("name").quoted(dds->get_dataset_name()).raw(',').newline();
 
     if (!sendData) {
         // Send metadata if we aren't sending data
 
         //Attributes
-        transform(strm, dds->get_attr_table(), indent);
-        if (dds->get_attr_table().get_size() > 0) *strm << ",";
-        *strm << endl;
+        transform(writer, dds->get_attr_table(), indent);
+        if (dds->get_attr_table().get_size() > 0) writer->raw(',');
+        writer->newline();
     }
 
     // Process the variables in the DDS
-    if (dds->num_var() > 0) {
-
-        libdap::DDS::Vars_iter vi = dds->var_begin();
-        libdap::DDS::Vars_iter ve = dds->var_end();
-        for (; vi != ve; vi++) {
-            if ((*vi)->send_p()) {
-
-                libdap::BaseType *v = *vi;
-                BESDEBUG(FoInstanceJsonTransform_debug_key, "Processing top level variable: " << v->name() << endl);
-
-                if (sentSomething) {
-                    *strm << ",";
-                    *strm << endl;
-                }
-                transform(strm, v, indent + _indent_increment, sendData);
-
-                sentSomething = true;
-            }
-        }
+    vector<libdap::BaseType *> vars;
+    for (libdap::DDS::Vars_iter vi = dds->var_begin(), ve = dds->var_end(); vi != ve; vi++) {
+        if ((*vi)->send_p()) vars.push_back(*vi);
     }
+    fojson::VariableWriter<FoInstanceJsonTransform>::write(*this, writer, vars, next_indent(indent), sendData, true);
 
     // Close the JSON object
-    *strm << endl << "}" << endl;
+    writer->newline().raw('}').newline();
 }
 
 /** @brief Transforms the BaseType object into a JSON instance object representation.
  *
  * Transforms the BaseType into a JSON document using an instance object representation.
  *
- * @param strm Stream to which to write JSON.
+ * @param writer Write the JSON here.
  * @param bt The BaseType to produce JSON from.
  * @param indent White space indent.
  * @param sendData If the sendData parameter is true data will be sent. If sendData is false then the metadata will be sent.
  */
-void FoInstanceJsonTransform::transform(std::ostream *strm, libdap::BaseType *bt, string indent, bool sendData)
+void FoInstanceJsonTransform::transform(fojson::JsonWriter *writer, libdap::BaseType *bt, const string &indent, bool sendData)
 {
     switch (bt->type()) {
     // Handle the atomic types - that's easy!
@@ -337,23 +496,23 @@ void FoInstanceJsonTransform::transform(std::ostream *strm, libdap::BaseType *bt
     case libdap::dods_float64_c:
     case libdap::dods_str_c:
     case libdap::dods_url_c:
-        transformAtomic(strm, bt, indent, sendData);
+        transformAtomic(writer, bt, indent, sendData);
         break;
 
     case libdap::dods_structure_c:
-        transform(strm, (libdap::Structure *) bt, indent, sendData);
+        transform(writer, (libdap::Structure *) bt, indent, sendData);
         break;
 
     case libdap::dods_grid_c:
-        transform(strm, (libdap::Grid *) bt, indent, sendData);
+        transform(writer, (libdap::Grid *) bt, indent, sendData);
         break;
 
     case libdap::dods_sequence_c:
-        transform(strm, (libdap::Sequence *) bt, indent, sendData);
+        transform(writer, (libdap::Sequence *) bt, indent, sendData);
         break;
 
     case libdap::dods_array_c:
-        transform(strm, (libdap::Array *) bt, indent, sendData);
+        transform(writer, (libdap::Array *) bt, indent, sendData);
         break;
 
     case libdap::dods_int8_c:
@@ -384,30 +543,22 @@ void FoInstanceJsonTransform::transform(std::ostream *strm, libdap::BaseType *bt
  * Transforms the BaseType into a JSON document using an instance object representation. The assumption here is
  * that the passed BaseType is an "atomic" type.
  *
- * @param strm Stream to which to write JSON.
+ * @param writer Write the JSON here.
  * @param bt The BaseType to produce JSON from.
  * @param indent White space indent.
  * @param sendData If the sendData parameter is true data will be sent. If sendData is false then the metadata will be sent.
  */
-void FoInstanceJsonTransform::transformAtomic(std::ostream *strm, libdap::BaseType *b, string indent, bool sendData)
+void FoInstanceJsonTransform::transformAtomic(fojson::JsonWriter *writer, libdap::BaseType *b, const string &indent, bool sendData)
 {
-    std::string name = b->name();
-    *strm << indent << "\"" << fojson::escape_for_json(name) << "\": ";
+    writer->raw(indent).raw(quoted_name(b)).colon();
 
     if (sendData) {
-
-        if (b->type() == libdap::dods_str_c || b->type() == libdap::dods_url_c) {
-            libdap::Str *strVar = (libdap::Str *) b;
-            std::string tmpString = strVar->value();
-            *strm << "\"" << fojson::escape_for_json(tmpString) << "\"";
-        }
-        else {
-            b->print_val(*strm, "", false);
-        }
-
+        _value_format.precision = _precision_spec.get_precision(b);
+        read_data(writer, b);
+        fojson::write_value(writer, b, _value_format);
     }
     else {
-        transform(strm, b->get_attr_table(), indent);
+        transform(writer, b->get_attr_table(), indent);
     }
 }
 
@@ -415,17 +566,16 @@ void FoInstanceJsonTransform::transformAtomic(std::ostream *strm, libdap::BaseTy
  *
  * Transforms the Structure into a JSON document using an instance object representation.
  *
- * @param strm Stream to which to write JSON.
+ * @param writer Write the JSON here.
  * @param bt The Structure to produce JSON from.
  * @param indent White space indent.
  * @param sendData If the sendData parameter is true data will be sent. If sendData is false then the metadata will be sent.
  */
-void FoInstanceJsonTransform::transform(std::ostream *strm, libdap::Structure *b, string indent, bool sendData)
+void FoInstanceJsonTransform::transform(fojson::JsonWriter *writer, libdap::Structure *b, const string &indent, bool sendData)
 {
 
     // Open object with name of the structure
-    std::string name = b->name();
-    *strm << indent << "\"" << fojson::escape_for_json(name) << "\": {" << endl;
+    writer->raw(indent).raw(quoted_name(b)).colon().raw('{').newline();
 
     // Process the variables.
     if (b->width(true) > 0) {
@@ -439,51 +589,50 @@ void FoInstanceJsonTransform::transform(std::ostream *strm, libdap::Structure *b
                 libdap::BaseType *v = *vi;
                 BESDEBUG(FoInstanceJsonTransform_debug_key,
                     "FoInstanceJsonTransform::transform() - Processing structure variable: " << v->name() << endl);
-                transform(strm, v, indent + _indent_increment, sendData);
+                transform(writer, v, next_indent(indent), sendData);
                 if ((vi + 1) != ve) {
-                    *strm << ",";
+                    writer->raw(',');
                 }
-                *strm << endl;
+                writer->newline();
             }
         }
     }
-    *strm << indent << "}";
+    writer->raw(indent).raw('}');
 }
 
 /** @brief Transforms the Grid object into a JSON instance object representation.
  *
  * Transforms the Grid into a JSON document using an instance object representation.
  *
- * @param strm Stream to which to write JSON.
+ * @param writer Write the JSON here.
  * @param bt The Grid to produce JSON from.
  * @param indent White space indent.
  * @param sendData If the sendData parameter is true data will be sent. If sendData is false then the metadata will be sent.
  */
-void FoInstanceJsonTransform::transform(std::ostream *strm, libdap::Grid *g, string indent, bool sendData)
+void FoInstanceJsonTransform::transform(fojson::JsonWriter *writer, libdap::Grid *g, const string &indent, bool sendData)
 {
 
     // Open JSON property object with name of the grid
-    std::string name = g->name();
-    *strm << indent << "\"" << fojson::escape_for_json(name) << "\": {" << endl;
+    writer->raw(indent).raw(quoted_name(g)).colon().raw('{').newline();
 
     BESDEBUG(FoInstanceJsonTransform_debug_key,
         "FoInstanceJsonTransform::transform() - Processing Grid data Array: " << g->get_array()->name() << endl);
 
     // Process the data array
-    transform(strm, g->get_array(), indent + _indent_increment, sendData);
-    *strm << "," << endl;
+    transform(writer, g->get_array(), next_indent(indent), sendData);
+    writer->raw(',').newline();
 
     // Process the MAP arrays
     for (libdap::Grid::Map_iter mapi = g->map_begin(); mapi < g->map_end(); mapi++) {
         BESDEBUG(FoInstanceJsonTransform_debug_key,
             "FoInstanceJsonTransform::transform() - Processing Grid Map Array: " << (*mapi)->name() << endl);
         if (mapi != g->map_begin()) {
-            *strm << "," << endl;
+            writer->raw(',').newline();
         }
-        transform(strm, *mapi, indent + _indent_increment, sendData);
+        transform(writer, *mapi, next_indent(indent), sendData);
     }
     // Close the JSON property object
-    *strm << endl << indent << "}";
+    writer->newline().raw(indent).raw('}');
 
 }
 
@@ -491,73 +640,81 @@ void FoInstanceJsonTransform::transform(std::ostream *strm, libdap::Grid *g, str
  *
  * Transforms the Sequence into a JSON document using an instance object representation.
  *
- * @param strm Stream to which to write JSON.
+ * @param writer Write the JSON here.
  * @param s The Sequence to produce JSON from.
  * @param indent White space indent.
  * @param sendData If the sendData parameter is true data will be sent. If sendData is false then the metadata will be sent.
  */
-void FoInstanceJsonTransform::transform(std::ostream *strm, libdap::Sequence *s, string indent, bool sendData)
+void FoInstanceJsonTransform::transform(fojson::JsonWriter *writer, libdap::Sequence *s, const string &indent, bool sendData)
 {
 
     // Open JSON property object with name of the sequence
-    std::string name = s->name();
-    *strm << indent << "\"" << fojson::escape_for_json(name) << "\": {" << endl;
+    writer->raw(indent).raw(quoted_name(s)).colon().raw('{').newline();
 
-    string child_indent = indent + _indent_increment;
+    const string &child_indent = next_indent(indent);
 
 #if 0
     the erdap way
-    *strm << indent << "\"table\": {" << endl;
+    *strm << indent << "\"table\"" << _colon << "{" << _newline;
 
     string child_indent = indent + _indent_increment;
 
-    *strm << child_indent << "\"name\": \"" << s->name() << "\"," << endl;
+    *strm << child_indent << "\"name\"" << _colon << "\"" << s->name() << "\"," << _newline;
 
 #endif
 
-    *strm << child_indent << "\"columnNames\": [";
+    writer->raw(child_indent).key("columnNames").raw('[');
     for (libdap::Constructor::Vars_iter v = s->var_begin(); v < s->var_end(); v++) {
-        if (v != s->var_begin()) *strm << ",";
-        std::string name = (*v)->name();
-        *strm << "\"" << fojson::escape_for_json(name) << "\"";
+        if (v != s->var_begin()) writer->raw(',');
+        writer->raw(quoted_name(*v));
     }
-    *strm << "]," << endl;
+    writer->raw("],", 2).newline();
 
-    *strm << child_indent << "\"columnTypes\": [";
+    writer->raw(child_indent).key("columnTypes").raw('[');
     for (libdap::Constructor::Vars_iter v = s->var_begin(); v < s->var_end(); v++) {
-        if (v != s->var_begin()) *strm << ",";
-        *strm << "\"" << (*v)->type_name() << "\"";
+        if (v != s->var_begin()) writer->raw(',');
+        writer->raw('"').raw((*v)->type_name()).raw('"');
     }
-    *strm << "]," << endl;
+    writer->raw("],", 2).newline();
 
     bool first = true;
-    *strm << child_indent << "\"rows\": [";
+    writer->raw(child_indent).key("rows").raw('[');
     while (s->read()) {
-        if (!first) *strm << ", ";
-        *strm << endl << child_indent << "[";
+        if (!first) writer->separator();
+        writer->newline().raw(child_indent).raw('[');
         for (libdap::Constructor::Vars_iter v = s->var_begin(); v < s->var_end(); v++) {
-            if (v != s->var_begin()) *strm << child_indent << ",";
-            transform(strm, (*v), child_indent + _indent_increment, sendData);
+            if (v != s->var_begin()) writer->raw(child_indent).raw(',');
+            transform(writer, (*v), next_indent(child_indent), sendData);
         }
-        *strm << child_indent << "]";
+        writer->raw(child_indent).raw(']');
         first = false;
+
+        // The next row is read into the same variables; free this row's
+        // arrays rather than hold the largest of them until the end
+        if (_release_data) {
+            for (libdap::Constructor::Vars_iter v = s->var_begin(); v < s->var_end(); v++)
+                if ((*v)->is_vector_type()) (*v)->clear_local_data();
+        }
+
+        // Stop reading rows as soon as the client has gone
+        writer->checkpoint();
     }
-    *strm << endl << child_indent << "]" << endl;
+    writer->newline().raw(child_indent).raw(']').newline();
 
     // Close the JSON property object
-    *strm << indent << "}" << endl;
+    writer->raw(indent).raw('}').newline();
 }
 
 /** @brief Transforms the Array object into a JSON instance object representation.
  *
  * Transforms the Array into a JSON document using an instance object representation.
  *
- * @param strm Stream to which to write JSON.
+ * @param writer Write the JSON here.
  * @param a The Array to produce JSON from.
  * @param indent White space indent.
  * @param sendData If the sendData parameter is true data will be sent. If sendData is false then the metadata will be sent.
  */
-void FoInstanceJsonTransform::transform(std::ostream *strm, libdap::Array *a, string indent, bool sendData)
+void FoInstanceJsonTransform::transform(fojson::JsonWriter *writer, libdap::Array *a, const string &indent, bool sendData)
 {
 
     BESDEBUG(FoInstanceJsonTransform_debug_key,
@@ -566,38 +723,38 @@ void FoInstanceJsonTransform::transform(std::ostream *strm, libdap::Array *a, st
     switch (a->var()->type()) {
     // Handle the atomic types - that's easy!
     case libdap::dods_byte_c:
-        json_simple_type_array<libdap::dods_byte>(strm, a, indent, sendData);
+        json_simple_type_array<libdap::dods_byte>(writer, a, indent, sendData);
         break;
 
     case libdap::dods_int16_c:
-        json_simple_type_array<libdap::dods_int16>(strm, a, indent, sendData);
+        json_simple_type_array<libdap::dods_int16>(writer, a, indent, sendData);
         break;
 
     case libdap::dods_uint16_c:
-        json_simple_type_array<libdap::dods_uint16>(strm, a, indent, sendData);
+        json_simple_type_array<libdap::dods_uint16>(writer, a, indent, sendData);
         break;
 
     case libdap::dods_int32_c:
-        json_simple_type_array<libdap::dods_int32>(strm, a, indent, sendData);
+        json_simple_type_array<libdap::dods_int32>(writer, a, indent, sendData);
         break;
 
     case libdap::dods_uint32_c:
-        json_simple_type_array<libdap::dods_uint32>(strm, a, indent, sendData);
+        json_simple_type_array<libdap::dods_uint32>(writer, a, indent, sendData);
         break;
 
     case libdap::dods_float32_c:
-        json_simple_type_array<libdap::dods_float32>(strm, a, indent, sendData);
+        json_simple_type_array<libdap::dods_float32>(writer, a, indent, sendData);
         break;
 
     case libdap::dods_float64_c:
-        json_simple_type_array<libdap::dods_float64>(strm, a, indent, sendData);
+        json_simple_type_array<libdap::dods_float64>(writer, a, indent, sendData);
         break;
 
     case libdap::dods_str_c: {
-        json_string_array(strm, a, indent, sendData);
+        json_string_array(writer, a, indent, sendData);
         break;
 #if 0
-        //json_simple_type_array<Str>(strm,a,indent);
+        //json_simple_type_array<Str>(writer,a,indent);
         string s = (string) "File out JSON, " + "Arrays of Strings are not yet a supported return type.";
         throw BESInternalError(s, __FILE__, __LINE__);
         break;
@@ -606,10 +763,10 @@ void FoInstanceJsonTransform::transform(std::ostream *strm, libdap::Array *a, st
     }
 
     case libdap::dods_url_c: {
-        json_string_array(strm, a, indent, sendData);
+        json_string_array(writer, a, indent, sendData);
         break;
 #if 0
-        //json_simple_type_array<Url>(strm,a,indent);
+        //json_simple_type_array<Url>(writer,a,indent);
         string s = (string) "File out JSON, " + "Arrays of URLs are not yet a supported return type.";
         throw BESInternalError(s, __FILE__, __LINE__);
         break;
@@ -668,19 +825,19 @@ void FoInstanceJsonTransform::transform(std::ostream *strm, libdap::Array *a, st
  * BaseType variable or a DDS) the is method does not open a new JSON object, but rather
  * continues to add content to the currently open object.
  *
- * @param strm Stream to which to write JSON.
+ * @param writer Write the JSON here.
  * @param a The AttrTable to produce JSON from.
  * @param indent White space indent.
  * @param sendData If the sendData parameter is true data will be sent. If sendData is false then the metadata will be sent.
  */
-void FoInstanceJsonTransform::transform(std::ostream *strm, libdap::AttrTable &attr_table, string indent)
+void FoInstanceJsonTransform::transform(fojson::JsonWriter *writer, libdap::AttrTable &attr_table, const string &indent)
 {
     /*
      * Since Attributes get promoted to JSON "properties" of their parent object (either a
      * BaseType variable or a DDS derived JSON object) this method does not open a new JSON
      * object, but rather continues to add content to the currently open object.
      */
-    string child_indent = indent + _indent_increment;
+    const string &child_indent = next_indent(indent);
 
     // Are there any attributes?
     if (attr_table.get_size() != 0) {
@@ -697,50 +854,44 @@ void FoInstanceJsonTransform::transform(std::ostream *strm, libdap::AttrTable &a
             {
                 libdap::AttrTable *atbl = attr_table.get_attr_table(at_iter);
 
-                if (at_iter != begin) *strm << "," << endl;
+                if (at_iter != begin) writer->raw(',').newline();
 
                 // Open a JSON property with the name of the Attribute Table and
-                std::string name = atbl->get_name();
-                *strm << child_indent << "\"" << fojson::escape_for_json(name) << "\": {" << endl;
+                writer->raw(child_indent).raw(quoted_name(atbl)).colon().raw('{').newline();
 
                 // Process the Attribute Table.
-                transform(strm, *atbl, child_indent + _indent_increment);
+                transform(writer, *atbl, next_indent(child_indent));
 
                 // Close JSON property object
-                *strm << endl << child_indent << "}";
+                writer->newline().raw(child_indent).raw('}');
 
                 break;
 
             }
             default: // so it's not an Attribute Table. woot. time to print
                 // First?
-                if (at_iter != begin) *strm << "," << endl;
+                if (at_iter != begin) writer->raw(',').newline();
 
                 // Name of property
-                std::string name = attr_table.get_name(at_iter);
-                *strm << child_indent << "\"" << fojson::escape_for_json(name) << "\": ";
+                writer->raw(child_indent).raw(quoted_name(attr_table, at_iter)).colon();
 
                 // Open values array
-                *strm << "[";
+                writer->raw('[');
                 // Process value(s)
                 std::vector<std::string> *values = attr_table.get_attr_vector(at_iter);
                 for (std::vector<std::string>::size_type i = 0; i < values->size(); i++) {
-                    if (i > 0) *strm << ",";
+                    if (i > 0) writer->raw(',');
                     if (attr_table.get_attr_type(at_iter) == libdap::Attr_string
                         || attr_table.get_attr_type(at_iter) == libdap::Attr_url) {
-                        *strm << "\"";
-
-                        string value = (*values)[i];
-                        *strm << fojson::escape_for_json(value);
-                        *strm << "\"";
+                        writer->quoted((*values)[i]);
                     }
                     else {
-                        *strm << (*values)[i];
+                        writer->raw((*values)[i]);
                     }
 
                 }
                 // Close values array
-                *strm << "]";
+                writer->raw(']');
                 break;
             }
         }
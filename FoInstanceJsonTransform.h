@@ -32,9 +32,15 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <deque>
+
+#include <AttrTable.h>
 
 #include <BESObj.h>
 
+#include "fojson_utils.h"
+#include "fojson_format.h"
+
 namespace libdap {
 class BaseType;
 class DDS;
@@ -43,6 +49,11 @@ class Array;
 
 class BESDataHandlerInterface;
 
+namespace fojson {
+class JsonWriter;
+template<class Transform> class VariableWriter;
+}
+
 
 /**
  * @brief Transforms a DDS into JSON document on disk.
@@ -58,24 +69,82 @@ private:
     std::string _returnAs;
     std::string _indent_increment;
 
+    // The indent of each depth, made the first time it is needed
+    std::deque<std::string> _indents;
+
+    // True to write the response without whitespace
+    bool _compact;
+
+    // Written between the ':' and the '[' of an array; empty when compact
+    const char *_array_space;
+
+    // Escaped and quoted names of the variables and attributes written so far
+    std::map<const void *, std::string> _quoted_names;
+
+    // Significant digits for Float32 and Float64 values, by variable
+    fojson::PrecisionSpec _precision_spec;
+
+    // How values are written: the precision of the variable being written
+    // and the text used for NaN and Inf
+    fojson::ValueFormat _value_format;
+
+    // When not null the variables are read as they are written with this
+    libdap::ConstraintEvaluator *_eval;
+
+    // Arrays read as they are written that are larger than this are read
+    // in slabs of about this size; 0 reads them whole
+    size_t _slab_bytes;
+
+    // True to free each top level variable's values once it is written
+    bool _release_data;
+
+    // Top level variables whose values have been read are written on this
+    // many threads
+    unsigned int _threads;
+
+    // Writes lists of variables, on those threads when it can
+    friend class fojson::VariableWriter<FoInstanceJsonTransform>;
+
+    // Make sure bt's values have been read before they are written
+    void read_data(fojson::JsonWriter *writer, libdap::BaseType *bt)
+    {
+        if (_eval) fojson::read_variable(writer, bt, *_eval, *_dds);
+    }
+
+    // Free the values of a top level variable once it has been written; those
+    // read as they are written are always freed
+    void release_written(libdap::BaseType *bt)
+    {
+        if ((_release_data || _eval) && !bt->get_parent()) bt->clear_local_data();
+    }
+
+    const std::string &next_indent(const std::string &indent);
+
+    const std::string &quoted_name(libdap::BaseType *bt);
+    const std::string &quoted_name(libdap::AttrTable *atbl);
+    const std::string &quoted_name(libdap::AttrTable &attr_table, libdap::AttrTable::Attr_iter at_iter);
+
     // std::ostream *_ostrm;
 
-    template<typename T> unsigned int json_simple_type_array_worker(std::ostream *strm, const std::vector<T> &values,
-        unsigned int indx, const std::vector<unsigned int> &shape, unsigned int currentDim);
+    template<typename T> uint64_t json_simple_type_array_worker(fojson::JsonWriter *writer, const T *values,
+        uint64_t indx, const std::vector<unsigned int> &shape, unsigned int currentDim);
+
+    template<typename T> uint64_t json_simple_type_array_slabs(fojson::JsonWriter *writer, libdap::Array *a,
+        const std::vector<unsigned int> &shape, unsigned int slab_rows);
 
-    template<typename T> void json_simple_type_array(std::ostream *strm, libdap::Array *a, std::string indent,
+    template<typename T> void json_simple_type_array(fojson::JsonWriter *writer, libdap::Array *a, const std::string &indent,
         bool sendData);
-    void json_string_array(std::ostream *strm, libdap::Array *a, std::string indent, bool sendData);
+    void json_string_array(fojson::JsonWriter *writer, libdap::Array *a, const std::string &indent, bool sendData);
 
-    void transformAtomic(std::ostream *strm, libdap::BaseType *bt, std::string indent, bool sendData);
+    void transformAtomic(fojson::JsonWriter *writer, libdap::BaseType *bt, const std::string &indent, bool sendData);
 
-    void transform(std::ostream *strm, libdap::DDS *dds, std::string indent, bool sendData);
-    void transform(std::ostream *strm, libdap::BaseType *bt, std::string indent, bool sendData);
-    void transform(std::ostream *strm, libdap::Structure *s, std::string indent, bool sendData);
-    void transform(std::ostream *strm, libdap::Grid *g, std::string indent, bool sendData);
-    void transform(std::ostream *strm, libdap::Sequence *s, std::string indent, bool sendData);
-    void transform(std::ostream *strm, libdap::Array *a, std::string indent, bool sendData);
-    void transform(std::ostream *strm, libdap::AttrTable &attr_table, std::string indent);
+    void transform(fojson::JsonWriter *writer, libdap::DDS *dds, const std::string &indent, bool sendData);
+    void transform(fojson::JsonWriter *writer, libdap::BaseType *bt, const std::string &indent, bool sendData);
+    void transform(fojson::JsonWriter *writer, libdap::Structure *s, const std::string &indent, bool sendData);
+    void transform(fojson::JsonWriter *writer, libdap::Grid *g, const std::string &indent, bool sendData);
+    void transform(fojson::JsonWriter *writer, libdap::Sequence *s, const std::string &indent, bool sendData);
+    void transform(fojson::JsonWriter *writer, libdap::Array *a, const std::string &indent, bool sendData);
+    void transform(fojson::JsonWriter *writer, libdap::AttrTable &attr_table, const std::string &indent);
 
 public:
     //FoInstanceJsonTransform(libdap::DDS *dds, BESDataHandlerInterface &dhi, const std::string &localfile);
@@ -85,6 +154,28 @@ public:
 
     virtual void transform(std::ostream &ostrm, bool sendData);
 
+    virtual bool size(bool sendData, uint64_t &bytes);
+
+    /// Set the JSON text written in place of NaN and Inf values
+    virtual void set_non_finite_as(const std::string &non_finite_as) { _value_format.non_finite = non_finite_as; }
+
+    /// Set the number of significant digits written for Float32 and Float64 variables
+    virtual void set_precision(const fojson::PrecisionSpec &precision_spec) { _precision_spec = precision_spec; }
+
+    virtual void set_compact(bool compact);
+
+    /// Read each variable just before it is written, using this evaluator
+    virtual void set_read_as_written(libdap::ConstraintEvaluator *eval) { _eval = eval; }
+
+    /// Read large Arrays in slabs of about this many bytes when they are read as written
+    virtual void set_slab_bytes(size_t slab_bytes) { _slab_bytes = slab_bytes; }
+
+    /// Free each variable's values as soon as it has been written
+    virtual void set_release_data(bool release_data) { _release_data = release_data; }
+
+    /// Write top level variables on this many threads when their values have been read
+    virtual void set_threads(unsigned int threads) { _threads = threads; }
+
     virtual void dump(std::ostream &strm) const;
 };
 
@@ -40,6 +40,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 
 #include <DataDDS.h>
 #include <BaseType.h>
@@ -59,40 +60,94 @@
 
 #include "FoInstanceJsonTransmitter.h"
 #include "FoInstanceJsonTransform.h"
+#include "DeflateStream.h"
+#include "ParallelDeflateStream.h"
+#include "SpillFile.h"
+#include "StreamFailed.h"
+#ifdef HAVE_ZSTD
+#include "ZstdStream.h"
+#endif
 
 using namespace libdap;
 
-#define FO_JSON_TEMP_DIR "/tmp"
-
-string FoInstanceJsonTransmitter::temp_dir;
+#define FO_JSON_PRECISION_CONTEXT "fojson_precision"
 
 /** @brief Construct the FoJsonTransmitter.
  *
  * The transmitter is created to add the ability to return OPeNDAP data
  * objects (DataDDS) as instance object representation JSON documents.
  *
- * The OPeNDAP data object is written to a JSON file locally in a
- * temporary directory specified by the BES configuration parameter
- * FoJson.Tempdir. If this variable is not found or is not set then it
- * defaults to the macro definition FO_JSON_TEMP_DIR.
+ * The module's settings are read from the BES configuration, and checked,
+ * here so that a bad value stops the BES from starting (see
+ * fojson::Config).
  */
 FoInstanceJsonTransmitter::FoInstanceJsonTransmitter() : BESBasicTransmitter()
 {
     add_method(DATA_SERVICE, FoInstanceJsonTransmitter::send_data);
     add_method(DDX_SERVICE, FoInstanceJsonTransmitter::send_metadata);
 
-    if (FoInstanceJsonTransmitter::temp_dir.empty()) {
-        // Where is the temp directory for creating these files
-        bool found = false;
-        string key = "FoJson.Tempdir";
-        TheBESKeys::TheKeys()->get_value(key, FoInstanceJsonTransmitter::temp_dir, found);
-        if (!found || FoInstanceJsonTransmitter::temp_dir.empty()) {
-            FoInstanceJsonTransmitter::temp_dir = FO_JSON_TEMP_DIR;
-        }
-        string::size_type len = FoInstanceJsonTransmitter::temp_dir.length();
-        if (FoInstanceJsonTransmitter::temp_dir[len - 1] == '/') {
-            FoInstanceJsonTransmitter::temp_dir = FoInstanceJsonTransmitter::temp_dir.substr(0, len - 1);
-        }
+    fojson::Config::TheConfig();
+}
+
+/**
+ * Write the response to the output stream, compressed when the request or
+ * the configuration asks for that. The compressed response is streamed; it
+ * is never held in memory.
+ *
+ * With FoJson.ComputeSize the exact size of an uncompressed response is
+ * stored in dhi.data[FO_JSON_RESPONSE_SIZE] before it is written, when it
+ * can be known (see size() in the transform).
+ *
+ * @param ft The transform that builds the response
+ * @param o_strm Write the response to this stream
+ * @param dhi Holds the request's returnAs and context
+ * @param sendData True: send data; false: send metadata
+ */
+void FoInstanceJsonTransmitter::transmit(FoInstanceJsonTransform &ft, ostream &o_strm, BESDataHandlerInterface &dhi, bool sendData)
+{
+    const fojson::Config *config = fojson::Config::TheConfig();
+    fojson::Compression response_compression = fojson::response_compression(dhi, config->compression);
+
+    // The size of a compressed response is not known until it is written
+    uint64_t size;
+    if (config->compute_size && response_compression == fojson::no_compression && ft.size(sendData, size)) {
+        ostringstream oss;
+        oss << size;
+        dhi.data[FO_JSON_RESPONSE_SIZE] = oss.str();
+        BESDEBUG("fojson", "FoInstanceJsonTransmitter::transmit - response size: " << size << " bytes" << endl);
+    }
+
+    if (response_compression == fojson::no_compression) {
+        ft.transform(o_strm, sendData);
+    }
+#ifdef HAVE_ZSTD
+    else if (response_compression == fojson::zstd_compression) {
+        // The dictionary is trained on metadata responses; data responses
+        // are compressed without it.
+        const ZSTD_CDict *cdict =
+            sendData ? 0 : fojson::ZstdDictionary::TheDictionary()->get_cdict(config->compression_level);
+        BESDEBUG("fojson", "FoInstanceJsonTransmitter::transmit - zstd, level " << config->compression_level << (cdict ? ", with dictionary" : "") << endl);
+
+        unsigned int workers = config->compression_threads > 1 ? config->compression_threads : 0;
+        fojson::ZstdStream z_strm(o_strm, config->compression_level, cdict, workers);
+        ft.transform(z_strm, sendData);
+        z_strm.finish();
+    }
+#endif
+    else if (config->compression_threads > 1) {
+        BESDEBUG("fojson", "FoInstanceJsonTransmitter::transmit - compressing, level " << config->compression_level << ", " << config->compression_threads << " threads" << endl);
+
+        fojson::ParallelDeflateStream z_strm(o_strm, response_compression, config->compression_level,
+            config->compression_threads);
+        ft.transform(z_strm, sendData);
+        z_strm.finish();
+    }
+    else {
+        BESDEBUG("fojson", "FoInstanceJsonTransmitter::transmit - compressing, level " << config->compression_level << endl);
+
+        fojson::DeflateStream z_strm(o_strm, response_compression, config->compression_level);
+        ft.transform(z_strm, sendData);
+        z_strm.finish();
     }
 }
 
@@ -117,6 +172,7 @@ FoInstanceJsonTransmitter::FoInstanceJsonTransmitter() : BESBasicTransmitter()
  */
 void FoInstanceJsonTransmitter::send_metadata(BESResponseObject *obj, BESDataHandlerInterface &dhi)
 {
+    const fojson::Config *config = fojson::Config::TheConfig();
     BESDEBUG("fojson", "FoJsonTransmitter::send_data - BEGIN transmitting JSON" << endl);
 
     try {
@@ -130,8 +186,15 @@ void FoInstanceJsonTransmitter::send_metadata(BESResponseObject *obj, BESDataHan
             throw BESInternalError("Output stream is not set, can not return as JSON", __FILE__, __LINE__);
 
         FoInstanceJsonTransform ft(processed_dds);
+        ft.set_compact(fojson::compact_response(dhi));
+        ft.set_threads(config->serialize_threads);
 
-        ft.transform(o_strm, false /* do not send data */);
+        transmit(ft, o_strm, dhi, false /* do not send data */);
+    }
+    catch (fojson::StreamFailed &e) {
+        // There is no one to send an error to
+        BESDEBUG("fojson", "FoInstanceJsonTransmitter::send_metadata - stopped: " << e.what() << endl);
+        return;
     }
     catch (Error &e) {
         throw BESDapError("Failed to transform data to JSON: " + e.get_error_message(), false, e.get_error_code(),
@@ -164,6 +227,7 @@ void FoInstanceJsonTransmitter::send_metadata(BESResponseObject *obj, BESDataHan
  */
 void FoInstanceJsonTransmitter::send_data(BESResponseObject *obj, BESDataHandlerInterface &dhi)
 {
+    const fojson::Config *config = fojson::Config::TheConfig();
     BESDEBUG("fojson", "FoJsonTransmitter::send_data - BEGIN transmitting JSON" << endl);
 
     try {
@@ -175,15 +239,78 @@ void FoInstanceJsonTransmitter::send_data(BESResponseObject *obj, BESDataHandler
         // from the DataHandlerInterface to load the DDS with values.
         // Note that the BESResponseObject will manage the loaded_dds object's
         // memory. Make this a shared_ptr<>. jhrg 9/6/16
-        DDS *loaded_dds = responseBuilder.intern_dap2_data(obj, dhi);
+        //
+        // When variables are read as they are written, the start of the
+        // response goes out before most of the data has been read.
+        //
+        // With FoJson.MaxMemoryBytes the memory the response needs is
+        // estimated from the constrained DDS before anything is read; one
+        // that does not fit is read as it is written, or refused.
+        bool read_as_written = config->read_as_written;
+        unsigned long slab_bytes = config->slab_bytes;
+        ConstraintEvaluator *eval = 0;
+        DDS *loaded_dds = 0;
+        if (read_as_written || config->max_memory_bytes) loaded_dds = fojson::constrain_dds(obj, dhi, &eval);
+        if (config->max_memory_bytes) {
+            fojson::admit_response(loaded_dds, config->max_memory_bytes, config->serialize_threads,
+                read_as_written, slab_bytes);
+        }
+        if (loaded_dds && read_as_written) {
+            fojson::read_sequences(loaded_dds, *eval);
+        }
+        else if (loaded_dds) {
+            // The constraint is parsed already; parsing it again in
+            // intern_dap2_data() would add its selection clauses twice
+            fojson::read_data(loaded_dds, *eval);
+            eval = 0;
+        }
+        else {
+            loaded_dds = responseBuilder.intern_dap2_data(obj, dhi);
+        }
 
         ostream &o_strm = dhi.get_output_stream();
         if (!o_strm)
             throw BESInternalError("Output stream is not set, can not return as JSON", __FILE__, __LINE__);
 
         FoInstanceJsonTransform ft(loaded_dds);
+        ft.set_compact(fojson::compact_response(dhi));
+        ft.set_non_finite_as(config->non_finite_as);
+
+        // A request can override the server's precision with a context
+        fojson::PrecisionSpec precision_spec = config->precision_spec;
+        bool found = false;
+        string precision = BESContextManager::TheManager()->get_context(FO_JSON_PRECISION_CONTEXT, found);
+        if (found) precision_spec.parse(precision);
+        ft.set_precision(precision_spec);
+        ft.set_read_as_written(eval);
+        ft.set_slab_bytes(slab_bytes);
+        ft.set_release_data(true);
+        ft.set_threads(config->serialize_threads);
 
-        ft.transform(o_strm, true /* send data */);
+        try {
+            if (config->spill_to_disk) {
+                // Render into a file at disk speed, release the data and only
+                // then send the response to a client that may read it slowly
+                fojson::SpillFile spill(config->temp_dir);
+                transmit(ft, spill.stream(), dhi, true /* send data */);
+                fojson::release_data(loaded_dds);
+                spill.send(o_strm);
+            }
+            else {
+                transmit(ft, o_strm, dhi, true /* send data */);
+            }
+        }
+        catch (...) {
+            // Most often the client went away part way through a large
+            // response; free its data now rather than with the response object
+            fojson::release_data(loaded_dds);
+            throw;
+        }
+    }
+    catch (fojson::StreamFailed &e) {
+        // There is no one to send an error to
+        BESDEBUG("fojson", "FoInstanceJsonTransmitter::send_data - stopped: " << e.what() << endl);
+        return;
     }
     catch (Error &e) {
         throw BESDapError("Failed to read data: " + e.get_error_message(), false, e.get_error_code(), __FILE__, __LINE__);
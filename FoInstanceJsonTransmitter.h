@@ -31,8 +31,11 @@
 
 #include <BESBasicTransmitter.h>
 
+#include "fojson_utils.h"
+
 class BESResponseObject;
 class BESDataHandlerInterface;
+class FoInstanceJsonTransform;
 
 /** @brief BESTransmitter class named "json" that transmits an OPeNDAP
  * data object as a JSON file
@@ -46,6 +49,18 @@ class BESDataHandlerInterface;
 class FoInstanceJsonTransmitter: public BESBasicTransmitter {
 private:
 	static string temp_dir;
+static string non_finite_as;
+static fojson::PrecisionSpec precision_spec;
+static fojson::Compression compression;
+static int compression_level;
+static unsigned int compression_threads;
+static bool spill_to_disk;
+static bool read_as_written;
+static unsigned long slab_bytes;
+static unsigned long max_memory_bytes;
+static unsigned int serialize_threads;
+
+static void transmit(FoInstanceJsonTransform &ft, std::ostream &o_strm, BESDataHandlerInterface &dhi, bool sendData);
 
 public:
 	FoInstanceJsonTransmitter();
@@ -47,8 +47,19 @@ using std::endl;
 #include <TheBESKeys.h>
 #include <BESDebug.h>
 
+#ifdef HAVE_ZSTD
+#include "ZstdStream.h"
+#endif
+
 #define RETURNAS_JSON "json"
 #define RETURNAS_IJSON "ijson"
+// Compact (no whitespace) versions of the above
+#define RETURNAS_JSON_MIN "json_min"
+#define RETURNAS_IJSON_MIN "ijson_min"
+// gzip compressed versions; these are .json.gz files, sent without a
+// Content-Encoding header, that the client must gunzip
+#define RETURNAS_JSON_GZ "json_gz"
+#define RETURNAS_IJSON_GZ "ijson_gz"
 
 
 
@@ -77,6 +88,31 @@ void FoJsonModule::initialize(const string &modname)
     BESDEBUG( "fojson", "    adding " << RETURNAS_IJSON << " transmitter" << endl );
     BESReturnManager::TheManager()->add_transmitter(RETURNAS_IJSON, new FoInstanceJsonTransmitter());
 
+    BESDEBUG( "fojson", "    adding " << RETURNAS_JSON_MIN << " transmitter" << endl );
+    BESReturnManager::TheManager()->add_transmitter(RETURNAS_JSON_MIN, new FoDapJsonTransmitter());
+
+    BESDEBUG( "fojson", "    adding " << RETURNAS_IJSON_MIN << " transmitter" << endl );
+    BESReturnManager::TheManager()->add_transmitter(RETURNAS_IJSON_MIN, new FoInstanceJsonTransmitter());
+
+    BESDEBUG( "fojson", "    adding " << RETURNAS_JSON_GZ << " transmitter" << endl );
+    BESReturnManager::TheManager()->add_transmitter(RETURNAS_JSON_GZ, new FoDapJsonTransmitter());
+
+    BESDEBUG( "fojson", "    adding " << RETURNAS_IJSON_GZ << " transmitter" << endl );
+    BESReturnManager::TheManager()->add_transmitter(RETURNAS_IJSON_GZ, new FoInstanceJsonTransmitter());
+
+
+#ifdef HAVE_ZSTD
+    // Load the zstd dictionary for metadata responses once, here, rather
+    // than for each response.
+    bool found = false;
+    string key = "FoJson.ZstdDictionary";
+    string dictionary;
+    TheBESKeys::TheKeys()->get_value(key, dictionary, found);
+    if (found && !dictionary.empty()) {
+        BESDEBUG( "fojson", "    loading zstd dictionary " << dictionary << endl );
+        fojson::ZstdDictionary::TheDictionary()->load(dictionary);
+    }
+#endif
 
     BESDebug::Register("fojson");
     BESDEBUG( "fojson", "Done Initializing module " << modname << endl );
@@ -96,6 +132,15 @@ void FoJsonModule::terminate(const string &modname)
     BESDEBUG( "fojson", "    removing " << RETURNAS_JSON << " transmitter" << endl );
 
     BESReturnManager::TheManager()->del_transmitter(RETURNAS_JSON);
+    BESReturnManager::TheManager()->del_transmitter(RETURNAS_IJSON);
+    BESReturnManager::TheManager()->del_transmitter(RETURNAS_JSON_MIN);
+    BESReturnManager::TheManager()->del_transmitter(RETURNAS_IJSON_MIN);
+    BESReturnManager::TheManager()->del_transmitter(RETURNAS_JSON_GZ);
+    BESReturnManager::TheManager()->del_transmitter(RETURNAS_IJSON_GZ);
+
+#ifdef HAVE_ZSTD
+    fojson::ZstdDictionary::delete_instance();
+#endif
 
     BESDEBUG( "fojson", "    removing " << modname << " request handler " << endl );
 
@@ -0,0 +1,108 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+//
+// JsonWriter.cc
+//
+// This file is part of BES JSON File Out Module
+//
+// Copyright (c) 2014 OPeNDAP, Inc.
+// Author: Nathan Potter <ndp@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+// (c) COPYRIGHT URI/MIT 1995-1999
+// Please read the full copyright statement in the file COPYRIGHT_URI.
+//
+
+
+#include "config.h"
+
+
+#include "JsonWriter.h"
+#include "fojson_utils.h"
+#include "StreamFailed.h"
+
+namespace fojson {
+
+/**
+ * @param strm Flush to this stream
+ * @param compact True to write no whitespace
+ * @param buffer_size Size of the buffer; must be at least large enough for
+ * any one number
+ */
+JsonWriter::JsonWriter(std::ostream &strm, bool compact, size_t buffer_size) :
+    _strm(strm), _compact(compact), _buf(0), _pos(0), _end(0), _sizing(false), _sized(0)
+{
+    if (buffer_size < 2 * max_number_chars) buffer_size = 2 * max_number_chars;
+
+    _buf = new char[buffer_size];
+    _pos = _buf;
+    _end = _buf + buffer_size;
+}
+
+JsonWriter::~JsonWriter()
+{
+    delete[] _buf;
+}
+
+// Hand the buffered text to the stream
+void JsonWriter::write_buffer()
+{
+    if (_pos != _buf) _strm.write(_buf, _pos - _buf);
+    _pos = _buf;
+    checkpoint();
+}
+
+// Text that does not fit in what is left of the buffer
+void JsonWriter::write_large(const char *s, size_t n)
+{
+    write_buffer();
+    if (n < size_t(_end - _buf)) {
+        memcpy(_pos, s, n);
+        _pos += n;
+    }
+    else {
+        _strm.write(s, n);
+        checkpoint();
+    }
+}
+
+// Stop writing a response that cannot be delivered
+void JsonWriter::stream_failed()
+{
+    throw StreamFailed();
+}
+
+/**
+ * Append a string value: escaped and enclosed in double quotes.
+ */
+JsonWriter &JsonWriter::quoted(const std::string &s)
+{
+    raw('"');
+    escape_for_json(this, s);
+    return raw('"');
+}
+
+/**
+ * Write the buffered text to the stream and flush the stream.
+ */
+void JsonWriter::flush()
+{
+    write_buffer();
+    _strm.flush();
+    checkpoint();
+}
+
+} // namespace fojson
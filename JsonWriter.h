@@ -0,0 +1,219 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+//
+// JsonWriter.h
+//
+// This file is part of BES JSON File Out Module
+//
+// Copyright (c) 2014 OPeNDAP, Inc.
+// Author: Nathan Potter <ndp@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+// (c) COPYRIGHT URI/MIT 1995-1999
+// Please read the full copyright statement in the file COPYRIGHT_URI.
+//
+
+
+#ifndef FOJSON_JSONWRITER_H_
+#define FOJSON_JSONWRITER_H_ 1
+
+#include <stdint.h>
+
+#include <cstring>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+#include "fojson_format.h"
+
+namespace fojson {
+
+/**
+ * @brief A buffered sink for JSON text.
+ *
+ * The transforms build the response with the append primitives here rather
+ * than with operator<<() on a std::ostream, which costs a virtual call, a
+ * sentry and a locale lookup per token. Text is collected in one large
+ * buffer that is handed to the underlying stream in big blocks.
+ *
+ * The writer also knows whether the output is compact; in that case
+ * colon(), separator() and newline() write no whitespace.
+ *
+ * Nothing is written to the stream until the buffer fills or flush() is
+ * called. The destructor does not flush.
+ *
+ * Each time the buffer is written the stream's state is checked; once the
+ * stream has failed (most often because the client disconnected) the writer
+ * throws StreamFailed rather than format the rest of the response for
+ * nobody. checkpoint() makes the same check and is cheap enough to call
+ * once per row in the transforms' loops.
+ *
+ * A writer that is sizing a response is given the length of the values of
+ * arrays rather than their text (see write_values() and values_size()).
+ * Written to a CountingStreambuf, the rest of the response is counted as
+ * it passes through, so the exact size of a response is found without
+ * formatting its values or holding it in memory.
+ */
+class JsonWriter {
+private:
+    std::ostream &_strm;
+    bool _compact;
+
+    char *_buf;
+    char *_pos;
+    char *_end;
+
+    bool _sizing;
+    uint64_t _sized;
+
+    void write_buffer();
+    void write_large(const char *s, size_t n);
+    void stream_failed();
+
+    JsonWriter(const JsonWriter &);
+    JsonWriter &operator=(const JsonWriter &);
+
+public:
+    /// Size of the buffer used when none is given to the constructor
+    static const size_t default_buffer_size = 256 * 1024;
+
+    /// Size of the buffer used to size a response, most of which is counted
+    /// rather than written
+    static const size_t sizing_buffer_size = 16 * 1024;
+
+    JsonWriter(std::ostream &strm, bool compact = false, size_t buffer_size = default_buffer_size);
+    virtual ~JsonWriter();
+
+    /// Is the output written without whitespace?
+    bool compact() const { return _compact; }
+
+    /// The stream this writer flushes to
+    std::ostream &stream() { return _strm; }
+
+    /// Count the length of array values instead of writing them
+    void set_sizing(bool sizing) { _sizing = sizing; }
+
+    /// Is this writer sizing a response? See the class description.
+    bool sizing() const { return _sizing; }
+
+    /// Add the length of text counted rather than written
+    void add_size(uint64_t n) { _sized += n; }
+
+    /// The length of the text counted rather than written
+    uint64_t sized() const { return _sized; }
+
+    /**
+     * Make room for at least n bytes (n must not be larger than the buffer)
+     * and return where to write them. Call commit() with the position
+     * following the last byte written.
+     */
+    char *reserve(size_t n)
+    {
+        if (size_t(_end - _pos) < n) write_buffer();
+        return _pos;
+    }
+
+    void commit(char *pos) { _pos = pos; }
+
+    /** @name raw
+     * Append text as is.
+     */
+    ///@{
+    JsonWriter &raw(const char *s, size_t n)
+    {
+        if (size_t(_end - _pos) >= n) {
+            memcpy(_pos, s, n);
+            _pos += n;
+        }
+        else {
+            write_large(s, n);
+        }
+        return *this;
+    }
+
+    JsonWriter &raw(const char *s) { return raw(s, strlen(s)); }
+
+    JsonWriter &raw(const std::string &s) { return raw(s.data(), s.length()); }
+
+    JsonWriter &raw(char c)
+    {
+        if (_pos == _end) write_buffer();
+        *_pos++ = c;
+        return *this;
+    }
+    ///@}
+
+    JsonWriter &quoted(const std::string &s);
+
+    /// Append "name" and the colon that follows it; name must not need escaping
+    JsonWriter &key(const char *name) { return raw('"').raw(name).raw('"').colon(); }
+
+    /// Append a number
+    template<typename T>
+    JsonWriter &number(T value)
+    {
+        commit(format_number(reserve(max_number_chars), value));
+        return *this;
+    }
+
+    /// Append ':', followed by a space unless the output is compact
+    JsonWriter &colon() { return _compact ? raw(':') : raw(": ", 2); }
+
+    /// Append ',', followed by a space unless the output is compact
+    JsonWriter &separator() { return _compact ? raw(',') : raw(", ", 2); }
+
+    /// Append a newline unless the output is compact
+    JsonWriter &newline() { return _compact ? *this : raw('\n'); }
+
+    /// Throw if the stream has failed; see the class description
+    void checkpoint()
+    {
+        if (_strm.fail()) stream_failed();
+    }
+
+    void flush();
+};
+
+/**
+ * @brief A streambuf that counts what is written to it and discards it.
+ */
+class CountingStreambuf: public std::streambuf {
+private:
+    uint64_t _count;
+
+protected:
+    virtual int_type overflow(int_type c)
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) ++_count;
+        return traits_type::not_eof(c);
+    }
+
+    virtual std::streamsize xsputn(const char *, std::streamsize n)
+    {
+        _count += n;
+        return n;
+    }
+
+public:
+    CountingStreambuf() : _count(0) { }
+
+    /// The number of bytes written so far
+    uint64_t count() const { return _count; }
+};
+
+} // namespace fojson
+
+#endif /* FOJSON_JSONWRITER_H_ */
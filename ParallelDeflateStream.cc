@@ -0,0 +1,322 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+//
+// ParallelDeflateStream.cc
+//
+// This file is part of BES JSON File Out Module
+//
+// Copyright (c) 2014 OPeNDAP, Inc.
+// Author: Nathan Potter <ndp@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+// (c) COPYRIGHT URI/MIT 1995-1999
+// Please read the full copyright statement in the file COPYRIGHT_URI.
+//
+
+
+#include "config.h"
+
+#include <cstring>
+
+#include <BESInternalError.h>
+#include <BESDebug.h>
+
+#include "ParallelDeflateStream.h"
+#include "StreamFailed.h"
+
+// The largest dictionary deflate can use
+#define DEFLATE_WINDOW (32 * 1024)
+
+namespace fojson {
+
+/**
+ * @param strm Write the compressed data to this stream
+ * @param compression deflate_compression (zlib format) or gzip_compression
+ * @param level zlib compression level, 0 (none) to 9 (best)
+ * @param threads The number of threads that compress; at least one
+ * @param block_size Size of the blocks the threads compress
+ * @throws BESInternalError if the threads cannot be started
+ */
+ParallelDeflateStreambuf::ParallelDeflateStreambuf(std::ostream &strm, Compression compression, int level,
+    unsigned int threads, size_t block_size) :
+    _strm(strm), _compression(compression), _level(level), _block_size(block_size), _current(block_size),
+    _header_written(false), _finished(false), _total_in(0), _stop(false)
+{
+    _check = compression == gzip_compression ? crc32(0, Z_NULL, 0) : adler32(0, Z_NULL, 0);
+
+    pthread_mutex_init(&_lock, 0);
+    pthread_cond_init(&_work_ready, 0);
+    pthread_cond_init(&_work_done, 0);
+
+    if (threads == 0) threads = 1;
+    for (unsigned int i = 0; i < threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, 0, worker, this) != 0) {
+            stop_workers();
+            throw BESInternalError("File out JSON, could not start the compression threads.", __FILE__, __LINE__);
+        }
+        _threads.push_back(thread);
+    }
+
+    BESDEBUG("fojson", "ParallelDeflateStreambuf - started " << threads << " threads" << std::endl);
+
+    setp(&_current[0], &_current[0] + _current.size());
+}
+
+ParallelDeflateStreambuf::~ParallelDeflateStreambuf()
+{
+    stop_workers();
+
+    // Left over if the response was abandoned
+    while (!_unwritten.empty()) {
+        delete _unwritten.front();
+        _unwritten.pop_front();
+    }
+}
+
+// Stop and join the worker threads, then free the lock and conditions
+void ParallelDeflateStreambuf::stop_workers()
+{
+    pthread_mutex_lock(&_lock);
+    _stop = true;
+    pthread_cond_broadcast(&_work_ready);
+    pthread_mutex_unlock(&_lock);
+
+    for (std::vector<pthread_t>::size_type i = 0; i < _threads.size(); i++)
+        pthread_join(_threads[i], 0);
+    _threads.clear();
+
+    pthread_cond_destroy(&_work_done);
+    pthread_cond_destroy(&_work_ready);
+    pthread_mutex_destroy(&_lock);
+}
+
+void *ParallelDeflateStreambuf::worker(void *arg)
+{
+    static_cast<ParallelDeflateStreambuf *>(arg)->compress_blocks();
+    return 0;
+}
+
+// The worker threads run this: compress blocks until told to stop. Each
+// block is raw deflate data; the gzip or zlib wrapper is written by the
+// thread that writes the blocks.
+void ParallelDeflateStreambuf::compress_blocks()
+{
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    bool ok = deflateInit2(&zs, _level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+
+    pthread_mutex_lock(&_lock);
+    for (;;) {
+        while (_pending.empty() && !_stop)
+            pthread_cond_wait(&_work_ready, &_lock);
+        if (_stop) break;
+
+        Block *block = _pending.front();
+        _pending.pop_front();
+        pthread_mutex_unlock(&_lock);
+
+        if (!ok) {
+            block->error = "could not initialize compression";
+        }
+        else {
+            deflateReset(&zs);
+            if (!block->dictionary.empty())
+                deflateSetDictionary(&zs, (Bytef *) &block->dictionary[0], block->dictionary.size());
+
+            zs.next_in = (Bytef *) (block->input.empty() ? 0 : &block->input[0]);
+            zs.avail_in = block->input.size();
+
+            block->output.resize(deflateBound(&zs, block->input.size()) + 64);
+            size_t have = 0;
+            for (;;) {
+                zs.next_out = (Bytef *) &block->output[have];
+                zs.avail_out = block->output.size() - have;
+                if (deflate(&zs, block->flush) == Z_STREAM_ERROR) {
+                    block->error = "compression failed";
+                    break;
+                }
+                have = block->output.size() - zs.avail_out;
+                if (zs.avail_out != 0) break;
+                block->output.resize(block->output.size() * 2);
+            }
+            block->output.resize(have);
+
+            const Bytef *input = (const Bytef *) (block->input.empty() ? 0 : &block->input[0]);
+            block->check = _compression == gzip_compression ?
+                crc32(0, input, block->input.size()) : adler32(1, input, block->input.size());
+        }
+
+        pthread_mutex_lock(&_lock);
+        block->done = true;
+        pthread_cond_broadcast(&_work_done);
+    }
+    pthread_mutex_unlock(&_lock);
+
+    if (ok) deflateEnd(&zs);
+}
+
+// Queue the text in the put area as a block, then write the oldest blocks
+// until no more than two per thread are outstanding.
+void ParallelDeflateStreambuf::submit(int flush)
+{
+    Block *block = new Block;
+    block->input.assign(pbase(), pptr());
+    block->dictionary = _dictionary;
+    block->flush = flush;
+    block->check = 0;
+    block->done = false;
+
+    // The next block's dictionary is the last 32k of the text so far
+    if (block->input.size() >= DEFLATE_WINDOW) {
+        _dictionary.assign(block->input.end() - DEFLATE_WINDOW, block->input.end());
+    }
+    else {
+        _dictionary.insert(_dictionary.end(), block->input.begin(), block->input.end());
+        if (_dictionary.size() > DEFLATE_WINDOW)
+            _dictionary.erase(_dictionary.begin(), _dictionary.end() - DEFLATE_WINDOW);
+    }
+
+    setp(&_current[0], &_current[0] + _current.size());
+
+    pthread_mutex_lock(&_lock);
+    _pending.push_back(block);
+    _unwritten.push_back(block);
+    pthread_cond_signal(&_work_ready);
+    pthread_mutex_unlock(&_lock);
+
+    while (_unwritten.size() > 2 * _threads.size())
+        write_oldest();
+}
+
+// Wait for the oldest block to be compressed and write it
+void ParallelDeflateStreambuf::write_oldest()
+{
+    Block *block = _unwritten.front();
+
+    pthread_mutex_lock(&_lock);
+    while (!block->done)
+        pthread_cond_wait(&_work_done, &_lock);
+    _unwritten.pop_front();
+    pthread_mutex_unlock(&_lock);
+
+    if (!block->error.empty()) {
+        std::string error = block->error;
+        delete block;
+        throw BESInternalError("File out JSON, " + error + ".", __FILE__, __LINE__);
+    }
+
+    if (!_header_written) write_header();
+
+    if (!block->output.empty() && !_strm.write(&block->output[0], block->output.size())) {
+        delete block;
+        throw StreamFailed();
+    }
+
+    uLong length = block->input.size();
+    _check = _compression == gzip_compression ?
+        crc32_combine(_check, block->check, length) : adler32_combine(_check, block->check, length);
+    _total_in += length;
+
+    delete block;
+}
+
+// The gzip header (no name or time) or the zlib header
+void ParallelDeflateStreambuf::write_header()
+{
+    if (_compression == gzip_compression) {
+        const char header[] = { '\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, 3 };
+        _strm.write(header, sizeof(header));
+    }
+    else {
+        // Window size 32k and the compression level, with the check bits
+        // that make the header a multiple of 31
+        int level = _level == 1 || _level == 0 ? 0 : _level < 6 ? 1 : _level == 6 ? 2 : 3;
+        unsigned int cmf = 0x78;
+        unsigned int flg = level << 6;
+        flg += 31 - (cmf * 256 + flg) % 31;
+        const char header[] = { char(cmf), char(flg) };
+        _strm.write(header, sizeof(header));
+    }
+
+    _header_written = true;
+}
+
+// The gzip trailer (CRC-32 and length, little-endian) or the zlib trailer
+// (Adler-32, big-endian)
+void ParallelDeflateStreambuf::write_trailer()
+{
+    unsigned char trailer[8];
+    if (_compression == gzip_compression) {
+        for (int i = 0; i < 4; i++) {
+            trailer[i] = (_check >> (8 * i)) & 0xff;
+            trailer[4 + i] = (_total_in >> (8 * i)) & 0xff;
+        }
+        _strm.write((const char *) trailer, 8);
+    }
+    else {
+        for (int i = 0; i < 4; i++)
+            trailer[i] = (_check >> (8 * (3 - i))) & 0xff;
+        _strm.write((const char *) trailer, 4);
+    }
+}
+
+ParallelDeflateStreambuf::int_type ParallelDeflateStreambuf::overflow(int_type c)
+{
+    if (_finished) throw BESInternalError("File out JSON, write after the end of the compressed response.", __FILE__, __LINE__);
+
+    submit(Z_SYNC_FLUSH);
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+
+    return traits_type::not_eof(c);
+}
+
+// Compress and write everything written so far
+int ParallelDeflateStreambuf::sync()
+{
+    if (!_finished) {
+        if (pptr() != pbase()) submit(Z_SYNC_FLUSH);
+        while (!_unwritten.empty())
+            write_oldest();
+    }
+    _strm.flush();
+
+    return _strm ? 0 : -1;
+}
+
+/**
+ * Compress anything still buffered, write the end of the compressed stream
+ * and flush the underlying stream. Nothing may be written after this.
+ */
+void ParallelDeflateStreambuf::finish()
+{
+    if (_finished) return;
+
+    submit(Z_FINISH);
+    while (!_unwritten.empty())
+        write_oldest();
+    write_trailer();
+
+    _finished = true;
+    _strm.flush();
+}
+
+} // namespace fojson
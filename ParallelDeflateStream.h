@@ -0,0 +1,155 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+//
+// ParallelDeflateStream.h
+//
+// This file is part of BES JSON File Out Module
+//
+// Copyright (c) 2014 OPeNDAP, Inc.
+// Author: Nathan Potter <ndp@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+// (c) COPYRIGHT URI/MIT 1995-1999
+// Please read the full copyright statement in the file COPYRIGHT_URI.
+//
+
+#ifndef FOJSON_PARALLELDEFLATESTREAM_H_
+#define FOJSON_PARALLELDEFLATESTREAM_H_ 1
+
+#include <pthread.h>
+
+#include <deque>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "fojson_utils.h"
+
+namespace fojson {
+
+/**
+ * @brief A streambuf that compresses with deflate on several threads.
+ *
+ * This works like pigz. The text written to it is cut into blocks that
+ * worker threads compress independently, each one using the last 32k of
+ * the text before it as a dictionary so that little is lost to the
+ * splitting. Every block except the last ends with a sync flush, so the
+ * compressed blocks can be written one after the other, in order, as a
+ * single gzip or zlib stream. The check value of the whole stream is
+ * combined from those of the blocks.
+ *
+ * At most two blocks per thread are waiting to be compressed or written,
+ * so the memory used is bounded. sync() writes every block compressed so
+ * far; finish() ends the stream.
+ *
+ * Errors throw BESInternalError; ParallelDeflateStream sets its exception
+ * mask so these reach the caller.
+ */
+class ParallelDeflateStreambuf: public std::streambuf {
+private:
+    struct Block {
+        std::vector<char> input;
+        std::vector<char> dictionary;
+        std::vector<char> output;
+        int flush;
+        uLong check;
+        bool done;
+        std::string error;
+    };
+
+    std::ostream &_strm;
+    Compression _compression;
+    int _level;
+    size_t _block_size;
+
+    std::vector<char> _current;
+    std::vector<char> _dictionary;
+    bool _header_written;
+    bool _finished;
+
+    uLong _check;
+    uLong _total_in;
+
+    std::vector<pthread_t> _threads;
+    pthread_mutex_t _lock;
+    pthread_cond_t _work_ready;
+    pthread_cond_t _work_done;
+    bool _stop;
+
+    // Blocks waiting for a worker, and all blocks not yet written, in order
+    std::deque<Block *> _pending;
+    std::deque<Block *> _unwritten;
+
+    static void *worker(void *arg);
+    void compress_blocks();
+
+    void submit(int flush);
+    void write_oldest();
+    void write_header();
+    void write_trailer();
+    void stop_workers();
+
+    ParallelDeflateStreambuf(const ParallelDeflateStreambuf &);
+    ParallelDeflateStreambuf &operator=(const ParallelDeflateStreambuf &);
+
+protected:
+    virtual int_type overflow(int_type c);
+    virtual int sync();
+
+public:
+    /// Size of the blocks compressed by the threads unless given to the constructor
+    static const size_t default_block_size = 128 * 1024;
+
+    ParallelDeflateStreambuf(std::ostream &strm, Compression compression, int level, unsigned int threads,
+        size_t block_size = default_block_size);
+    virtual ~ParallelDeflateStreambuf();
+
+    void finish();
+};
+
+/**
+ * @brief An output stream that compresses with a ParallelDeflateStreambuf.
+ */
+class ParallelDeflateStream: public std::ostream {
+private:
+    ParallelDeflateStreambuf _buf;
+
+public:
+    /**
+     * @param strm Write the compressed data to this stream
+     * @param compression deflate_compression or gzip_compression
+     * @param level zlib compression level, 0 (none) to 9 (best)
+     * @param threads The number of threads that compress
+     */
+    ParallelDeflateStream(std::ostream &strm, Compression compression, int level, unsigned int threads) :
+        std::ostream(0), _buf(strm, compression, level, threads)
+    {
+        rdbuf(&_buf);
+        exceptions(std::ios::badbit);
+    }
+
+    virtual ~ParallelDeflateStream() { }
+
+    /// Write the end of the compressed stream and flush the underlying stream
+    void finish() { _buf.finish(); }
+};
+
+} // namespace fojson
+
+#endif /* FOJSON_PARALLELDEFLATESTREAM_H_ */
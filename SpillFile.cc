@@ -0,0 +1,215 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+//
+// SpillFile.cc
+//
+// This file is part of BES JSON File Out Module
+//
+// Copyright (c) 2014 OPeNDAP, Inc.
+// Author: Nathan Potter <ndp@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+// (c) COPYRIGHT URI/MIT 1995-1999
+// Please read the full copyright statement in the file COPYRIGHT_URI.
+//
+
+#include "config.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/types.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
+#ifdef __GLIBCXX__
+#include <ext/stdio_filebuf.h>
+#include <ext/stdio_sync_filebuf.h>
+#endif
+
+#include <BESInternalError.h>
+#include <BESDebug.h>
+
+#include "SpillFile.h"
+#include "StreamFailed.h"
+
+using namespace std;
+
+namespace fojson {
+
+/// Size of the reads used to copy the file when sendfile(2) cannot be used
+static const size_t copy_block_size = 1024 * 1024;
+
+/// Size of the buffer the response is written to the file from
+static const size_t write_buffer_size = 64 * 1024;
+
+/**
+ * The file descriptor an output stream writes to, once anything it buffers
+ * has been written, or -1 if the stream does not write to a descriptor that
+ * can be found.
+ */
+static int output_fd(ostream &strm)
+{
+    strm.flush();
+
+#ifdef __GLIBCXX__
+    // std::cout and friends when they are synchronized with stdio
+    __gnu_cxx::stdio_sync_filebuf<char> *sync_buf = dynamic_cast<__gnu_cxx::stdio_sync_filebuf<char> *>(strm.rdbuf());
+    if (sync_buf) {
+        fflush(sync_buf->file());
+        return fileno(sync_buf->file());
+    }
+
+    __gnu_cxx::stdio_filebuf<char> *file_buf = dynamic_cast<__gnu_cxx::stdio_filebuf<char> *>(strm.rdbuf());
+    if (file_buf) return file_buf->fd();
+#endif
+
+    return -1;
+}
+
+SpillFile::FdBuf::FdBuf() :
+    _fd(-1), _error(0), _buffer(write_buffer_size)
+{
+    setp(&_buffer[0], &_buffer[0] + _buffer.size());
+}
+
+// Write what is buffered to the file; false if that fails
+bool SpillFile::FdBuf::write_buffer()
+{
+    const char *data = pbase();
+    while (data < pptr()) {
+        ssize_t n = write(_fd, data, pptr() - data);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            _error = n < 0 ? errno : EIO;
+            return false;
+        }
+        data += n;
+    }
+    setp(&_buffer[0], &_buffer[0] + _buffer.size());
+    return true;
+}
+
+SpillFile::FdBuf::int_type SpillFile::FdBuf::overflow(int_type c)
+{
+    if (!write_buffer()) return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+int SpillFile::FdBuf::sync()
+{
+    return write_buffer() ? 0 : -1;
+}
+
+/**
+ * @param dir Make the file in this directory
+ * @throws BESInternalError if the file cannot be made
+ */
+SpillFile::SpillFile(const string &dir) :
+    _fd(-1), _strm(&_buf)
+{
+    string name_template = dir + "/fojson_XXXXXX";
+    vector<char> name(name_template.begin(), name_template.end());
+    name.push_back('\0');
+
+    _fd = mkstemp(&name[0]);
+    if (_fd == -1)
+        throw BESInternalError("File out JSON, could not make a temporary file in " + dir + ": " + strerror(errno),
+            __FILE__, __LINE__);
+    unlink(&name[0]);
+
+    _buf.set_fd(_fd);
+    _strm.exceptions(ios::badbit);
+
+    BESDEBUG("fojson", "SpillFile::SpillFile - rendering into " << &name[0] << endl);
+}
+
+SpillFile::~SpillFile()
+{
+    close(_fd);
+}
+
+/**
+ * Copy part of the file to a stream by reading it in large blocks.
+ */
+void SpillFile::copy_to(ostream &strm, off_t offset, off_t size)
+{
+    vector<char> block(copy_block_size);
+    while (offset < size) {
+        ssize_t n = pread(_fd, &block[0], block.size(), offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0)
+            throw BESInternalError(string("File out JSON, could not read the temporary file: ") + strerror(errno),
+                __FILE__, __LINE__);
+        if (!strm.write(&block[0], n)) throw StreamFailed();
+        offset += n;
+    }
+    if (!strm.flush()) throw StreamFailed();
+}
+
+/**
+ * Send the rendered response to a stream. When the stream writes to a file
+ * descriptor the kernel copies the file with sendfile(2); otherwise it is
+ * read and written in large blocks.
+ *
+ * @param strm The response's output stream
+ * @throws BESInternalError if the response cannot be written to the file
+ * (e.g., the disk is full) or the file cannot be sent
+ * @throws StreamFailed if the client has disconnected
+ */
+void SpillFile::send(ostream &strm)
+{
+    if (_strm.fail() || _buf.pubsync() == -1)
+        throw BESInternalError(string("File out JSON, could not write the temporary file")
+            + (_buf.error() ? string(": ") + strerror(_buf.error()) : string(".")), __FILE__, __LINE__);
+
+    off_t size = lseek(_fd, 0, SEEK_END);
+    if (size == -1)
+        throw BESInternalError(string("File out JSON, could not size the temporary file: ") + strerror(errno),
+            __FILE__, __LINE__);
+
+    off_t offset = 0;
+#ifdef HAVE_SYS_SENDFILE_H
+    int fd = output_fd(strm);
+    while (fd != -1 && offset < size) {
+        ssize_t n = sendfile(fd, _fd, &offset, size - offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && offset == 0 && (errno == EINVAL || errno == ENOSYS)) break;    // Copy it instead
+        if (n < 0 && (errno == EPIPE || errno == ECONNRESET)) throw StreamFailed();
+        if (n <= 0)
+            throw BESInternalError(string("File out JSON, could not send the response: ") + strerror(errno),
+                __FILE__, __LINE__);
+    }
+    BESDEBUG("fojson", "SpillFile::send - sent " << offset << " of " << size << " bytes with sendfile" << endl);
+#endif
+
+    copy_to(strm, offset, size);
+}
+
+} // namespace fojson
@@ -0,0 +1,101 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+//
+// SpillFile.h
+//
+// This file is part of BES JSON File Out Module
+//
+// Copyright (c) 2014 OPeNDAP, Inc.
+// Author: Nathan Potter <ndp@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+// (c) COPYRIGHT URI/MIT 1995-1999
+// Please read the full copyright statement in the file COPYRIGHT_URI.
+//
+
+#ifndef FOJSON_SPILLFILE_H_
+#define FOJSON_SPILLFILE_H_ 1
+
+#include <sys/types.h>
+
+#include <string>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+namespace fojson {
+
+/**
+ * @brief A temporary file that a response is rendered into before it is
+ * sent to the client.
+ *
+ * Rendering into the file runs at disk speed no matter how slowly the client
+ * reads, so the data read for the response can be released before the
+ * (possibly long) transfer to the client starts.
+ *
+ * The file is made with mkstemp(3) from the template
+ * <dir>/fojson_XXXXXX, so concurrent BES processes never share a file. It
+ * is unlinked as soon as it is made and only ever used through the
+ * descriptor mkstemp() returns; the file has no name while it is in use and
+ * the kernel removes it when the SpillFile is destroyed, even if the BES
+ * exits without doing so.
+ */
+class SpillFile {
+private:
+    // Buffers what the stream writes and writes it to the file descriptor
+    class FdBuf: public std::streambuf {
+    private:
+        int _fd;
+        int _error;
+        std::vector<char> _buffer;
+
+        bool write_buffer();
+
+    protected:
+        virtual int_type overflow(int_type c);
+        virtual int sync();
+
+    public:
+        FdBuf();
+
+        void set_fd(int fd) { _fd = fd; }
+
+        /// The errno of the write that failed, or 0
+        int error() const { return _error; }
+    };
+
+    int _fd;
+    FdBuf _buf;
+    std::ostream _strm;
+
+    void copy_to(std::ostream &strm, off_t offset, off_t size);
+
+    SpillFile(const SpillFile &);
+    SpillFile &operator=(const SpillFile &);
+
+public:
+    SpillFile(const std::string &dir);
+    virtual ~SpillFile();
+
+    /// Render the response into this stream
+    std::ostream &stream() { return _strm; }
+
+    void send(std::ostream &strm);
+};
+
+} // namespace fojson
+
+#endif /* FOJSON_SPILLFILE_H_ */
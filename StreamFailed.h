@@ -0,0 +1,53 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+//
+// StreamFailed.h
+//
+// This file is part of BES JSON File Out Module
+//
+// Copyright (c) 2014 OPeNDAP, Inc.
+// Author: Nathan Potter <ndp@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+// (c) COPYRIGHT URI/MIT 1995-1999
+// Please read the full copyright statement in the file COPYRIGHT_URI.
+//
+
+#ifndef FOJSON_STREAMFAILED_H_
+#define FOJSON_STREAMFAILED_H_ 1
+
+#include <exception>
+
+namespace fojson {
+
+/**
+ * @brief Thrown when the stream a response is written to has failed, most
+ * often because the client disconnected.
+ *
+ * This is not a BESError: there is no one left to send an error response
+ * to, so the transmitters catch it and stop without one.
+ */
+class StreamFailed: public std::exception {
+public:
+    virtual const char *what() const throw()
+    {
+        return "File out JSON, could not write the response; the client may have disconnected.";
+    }
+};
+
+} // namespace fojson
+
+#endif /* FOJSON_STREAMFAILED_H_ */
@@ -0,0 +1,235 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+//
+// TaskQueue.cc
+//
+// This file is part of BES JSON File Out Module
+//
+// Copyright (c) 2014 OPeNDAP, Inc.
+// Author: Nathan Potter <ndp@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+// (c) COPYRIGHT URI/MIT 1995-1999
+// Please read the full copyright statement in the file COPYRIGHT_URI.
+//
+
+#include "config.h"
+
+#include <exception>
+#include <stdexcept>
+
+#include <Error.h>
+
+#include <BESError.h>
+#include <BESDapError.h>
+#include <BESForbiddenError.h>
+#include <BESInternalError.h>
+#include <BESInternalFatalError.h>
+#include <BESNotFoundError.h>
+#include <BESSyntaxUserError.h>
+#include <BESDebug.h>
+
+#include "TaskQueue.h"
+
+namespace fojson {
+
+// A copy of an exception of type E
+template<class E>
+class ThrownAs: public TaskQueue::Thrown {
+private:
+    E _e;
+
+public:
+    ThrownAs(const E &e) : _e(e) { }
+
+    virtual void rethrow() const { throw _e; }
+};
+
+/**
+ * @param threads The number of threads that run the tasks; at least one
+ * is started
+ * @throws BESInternalError if the threads cannot be started
+ */
+TaskQueue::TaskQueue(unsigned int threads) : _stop(false), _numbered(0)
+{
+    pthread_mutex_init(&_lock, 0);
+    pthread_cond_init(&_work_ready, 0);
+    pthread_cond_init(&_work_done, 0);
+
+    if (threads == 0) threads = 1;
+    for (unsigned int i = 0; i < threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, 0, worker, this) != 0) {
+            stop_workers();
+            throw BESInternalError("File out JSON, could not start the serialization threads.", __FILE__, __LINE__);
+        }
+        _threads.push_back(thread);
+    }
+
+    BESDEBUG("fojson", "TaskQueue - started " << threads << " threads" << std::endl);
+}
+
+/**
+ * Tasks still running are finished, those that have not started are not
+ * run, and all that have not been returned are deleted.
+ */
+TaskQueue::~TaskQueue()
+{
+    stop_workers();
+
+    while (!_unreturned.empty()) {
+        delete _unreturned.front();
+        _unreturned.pop_front();
+    }
+}
+
+// Stop and join the worker threads, then free the lock and conditions
+void TaskQueue::stop_workers()
+{
+    pthread_mutex_lock(&_lock);
+    _stop = true;
+    pthread_cond_broadcast(&_work_ready);
+    pthread_mutex_unlock(&_lock);
+
+    for (std::vector<pthread_t>::size_type i = 0; i < _threads.size(); i++)
+        pthread_join(_threads[i], 0);
+    _threads.clear();
+
+    pthread_cond_destroy(&_work_done);
+    pthread_cond_destroy(&_work_ready);
+    pthread_mutex_destroy(&_lock);
+}
+
+void *TaskQueue::worker(void *arg)
+{
+    static_cast<TaskQueue *>(arg)->run_tasks();
+    return 0;
+}
+
+// Run a task; return a copy of what it threw, or null. The most derived
+// types come first so that each error is copied as what it is.
+TaskQueue::Thrown *TaskQueue::run_task(Task *task, unsigned int thread)
+{
+    try {
+        task->run(thread);
+        return 0;
+    }
+    catch (BESSyntaxUserError &e) {
+        return new ThrownAs<BESSyntaxUserError>(e);
+    }
+    catch (BESNotFoundError &e) {
+        return new ThrownAs<BESNotFoundError>(e);
+    }
+    catch (BESForbiddenError &e) {
+        return new ThrownAs<BESForbiddenError>(e);
+    }
+    catch (BESInternalFatalError &e) {
+        return new ThrownAs<BESInternalFatalError>(e);
+    }
+    catch (BESInternalError &e) {
+        return new ThrownAs<BESInternalError>(e);
+    }
+    catch (BESDapError &e) {
+        return new ThrownAs<BESDapError>(e);
+    }
+    catch (BESError &e) {
+        return new ThrownAs<BESError>(e);
+    }
+    catch (libdap::Error &e) {
+        return new ThrownAs<libdap::Error>(e);
+    }
+    catch (std::exception &e) {
+        return new ThrownAs<std::runtime_error>(std::runtime_error(e.what()));
+    }
+    catch (...) {
+        return new ThrownAs<BESInternalError>(BESInternalError(
+            "File out JSON, unknown error while writing a variable.", __FILE__, __LINE__));
+    }
+}
+
+// The worker threads run this: run tasks until told to stop
+void TaskQueue::run_tasks()
+{
+    pthread_mutex_lock(&_lock);
+    unsigned int thread = _numbered++;
+    for (;;) {
+        while (_pending.empty() && !_stop)
+            pthread_cond_wait(&_work_ready, &_lock);
+        if (_stop) break;
+
+        Task *task = _pending.front();
+        _pending.pop_front();
+        pthread_mutex_unlock(&_lock);
+
+        Thrown *thrown = run_task(task, thread);
+
+        pthread_mutex_lock(&_lock);
+        task->_thrown = thrown;
+        task->_done = true;
+        pthread_cond_broadcast(&_work_done);
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+/**
+ * Queue a task to be run on the next free thread. The queue owns the task
+ * until next() returns it.
+ */
+void TaskQueue::submit(Task *task)
+{
+    pthread_mutex_lock(&_lock);
+    _pending.push_back(task);
+    _unreturned.push_back(task);
+    pthread_cond_signal(&_work_ready);
+    pthread_mutex_unlock(&_lock);
+}
+
+/**
+ * Wait for the oldest task not yet returned to finish and return it; the
+ * caller must delete it.
+ *
+ * @return The task, or null if there are none
+ * @throws A copy of what the task threw, if it did; the task is deleted
+ */
+TaskQueue::Task *TaskQueue::next()
+{
+    if (_unreturned.empty()) return 0;
+
+    Task *task = _unreturned.front();
+
+    pthread_mutex_lock(&_lock);
+    while (!task->_done)
+        pthread_cond_wait(&_work_done, &_lock);
+    _unreturned.pop_front();
+    pthread_mutex_unlock(&_lock);
+
+    if (task->_thrown) {
+        Thrown *thrown = task->_thrown;
+        task->_thrown = 0;
+        try {
+            delete task;
+            thrown->rethrow();
+        }
+        catch (...) {
+            delete thrown;
+            throw;
+        }
+    }
+
+    return task;
+}
+
+} // namespace fojson
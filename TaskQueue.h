@@ -0,0 +1,120 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+//
+// TaskQueue.h
+//
+// This file is part of BES JSON File Out Module
+//
+// Copyright (c) 2014 OPeNDAP, Inc.
+// Author: Nathan Potter <ndp@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+// (c) COPYRIGHT URI/MIT 1995-1999
+// Please read the full copyright statement in the file COPYRIGHT_URI.
+//
+
+#ifndef FOJSON_TASKQUEUE_H_
+#define FOJSON_TASKQUEUE_H_ 1
+
+#include <pthread.h>
+
+#include <deque>
+#include <vector>
+
+namespace fojson {
+
+/**
+ * @brief Runs tasks on a few threads and hands them back in the order they
+ * were submitted.
+ *
+ * The transforms use this to write several variables at once, each into its
+ * own buffer, and then write the buffers one after the other so that the
+ * response is the same as when the variables are written in turn. The
+ * caller bounds the memory used by taking finished tasks back with next()
+ * before submitting more.
+ *
+ * An exception thrown by a task is caught on its thread and a copy of it is
+ * thrown again by the next() that returns that task. BES and libdap errors
+ * keep their type, so a syntax error is still reported as one; other
+ * std::exceptions are thrown again as std::runtime_error.
+ */
+class TaskQueue {
+public:
+    /// A copy of what a task threw, to be thrown again on another thread
+    class Thrown {
+    public:
+        virtual ~Thrown() { }
+        virtual void rethrow() const = 0;
+    };
+
+    /// A unit of work; subclasses hold their input and output
+    class Task {
+    private:
+        friend class TaskQueue;
+        bool _done;
+        Thrown *_thrown;
+
+        Task(const Task &);
+        Task &operator=(const Task &);
+
+    public:
+        Task() : _done(false), _thrown(0) { }
+        virtual ~Task() { delete _thrown; }
+
+        /// Do the work; called on the queue's thread number thread, counting
+        /// from 0, so a task can use state kept for that thread
+        virtual void run(unsigned int thread) = 0;
+    };
+
+private:
+    std::vector<pthread_t> _threads;
+    pthread_mutex_t _lock;
+    pthread_cond_t _work_ready;
+    pthread_cond_t _work_done;
+    bool _stop;
+
+    // The number of threads that have taken their number
+    unsigned int _numbered;
+
+    // Tasks waiting for a thread, and all tasks not yet returned, in order
+    std::deque<Task *> _pending;
+    std::deque<Task *> _unreturned;
+
+    static void *worker(void *arg);
+    static Thrown *run_task(Task *task, unsigned int thread);
+    void run_tasks();
+    void stop_workers();
+
+    TaskQueue(const TaskQueue &);
+    TaskQueue &operator=(const TaskQueue &);
+
+public:
+    TaskQueue(unsigned int threads);
+    virtual ~TaskQueue();
+
+    /// The number of threads that run the tasks
+    unsigned int threads() const { return _threads.size(); }
+
+    /// The number of tasks submitted and not yet returned by next()
+    std::deque<Task *>::size_type size() const { return _unreturned.size(); }
+
+    void submit(Task *task);
+    Task *next();
+};
+
+} // namespace fojson
+
+#endif /* FOJSON_TASKQUEUE_H_ */
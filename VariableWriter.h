@@ -0,0 +1,250 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+//
+// VariableWriter.h
+//
+// This file is part of BES JSON File Out Module
+//
+// Copyright (c) 2014 OPeNDAP, Inc.
+// Author: Nathan Potter <ndp@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+// (c) COPYRIGHT URI/MIT 1995-1999
+// Please read the full copyright statement in the file COPYRIGHT_URI.
+//
+
+#ifndef FOJSON_VARIABLEWRITER_H_
+#define FOJSON_VARIABLEWRITER_H_ 1
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <BaseType.h>
+
+#include <BESDebug.h>
+
+#include "JsonWriter.h"
+#include "TaskQueue.h"
+#include "fojson_utils.h"
+
+namespace fojson {
+
+/**
+ * @brief Writes a list of variables at one indent for either transform.
+ *
+ * Variables are written one after the other, separated by a comma and a
+ * newline when asked. Top level variables whose values have all been read
+ * are written on the transform's _threads threads when there is more than
+ * one, each into a buffer; the buffers are written in order so the
+ * response is the same. Only variables with no more than max_task_bytes of
+ * values are written that way and at most two per thread are held as
+ * text, so the memory that takes is bounded (see estimate_memory()).
+ * Larger variables are written in turn once those before them have been.
+ *
+ * Each thread writes with its own copy of the transform, made once for
+ * the list, since the name and indent caches and the value format change
+ * as a variable is written.
+ *
+ * Variables read as they are written and the rows of Sequences are read
+ * by the data handler, which is only ever called from one thread, so
+ * those are always written in turn.
+ *
+ * BESDEBUG writes to one shared stream and is not safe to call from more
+ * than one thread. The transforms log as they write, so while the fojson
+ * debug context is on everything is written on the calling thread.
+ *
+ * Transform is FoDapJsonTransform or FoInstanceJsonTransform, which make
+ * this class a friend.
+ */
+template<class Transform>
+class VariableWriter {
+private:
+    // One copy of the transform per thread
+    class Copies {
+    public:
+        std::vector<Transform *> transforms;
+
+        Copies(const Transform &ft, unsigned int threads)
+        {
+            try {
+                for (unsigned int i = 0; i < threads; i++) {
+                    transforms.push_back(new Transform(ft));
+                    transforms.back()->set_threads(1);
+                }
+            }
+            catch (...) {
+                release();
+                throw;
+            }
+        }
+
+        ~Copies() { release(); }
+
+        void release()
+        {
+            for (typename std::vector<Transform *>::size_type i = 0; i < transforms.size(); i++)
+                delete transforms[i];
+            transforms.clear();
+        }
+    };
+
+    // Writes one variable into its own buffer
+    class VariableTask: public TaskQueue::Task {
+    public:
+        Copies &copies;
+        libdap::BaseType *var;
+        std::string indent;
+        bool send_data;
+        std::ostringstream output;
+
+        VariableTask(Copies &c, libdap::BaseType *v, const std::string &ind, bool sendData) :
+            copies(c), var(v), indent(ind), send_data(sendData)
+        {
+        }
+
+        virtual void run(unsigned int thread)
+        {
+            Transform &ft = *copies.transforms[thread];
+            JsonWriter writer(output, ft._compact);
+            write_one(ft, &writer, var, indent, send_data);
+            writer.flush();
+        }
+    };
+
+    Transform &_ft;
+    JsonWriter *_writer;
+    const std::string &_indent;
+    bool _send_data;
+    bool _separate;
+    bool _first;
+
+    // Declared before the queue so the threads are stopped before the
+    // copies they use are deleted
+    Copies _copies;
+    TaskQueue _tasks;
+
+    VariableWriter(Transform &ft, JsonWriter *writer, const std::string &indent, bool sendData, bool separate,
+        unsigned int threads) :
+        _ft(ft), _writer(writer), _indent(indent), _send_data(sendData), _separate(separate), _first(true),
+        _copies(ft, threads), _tasks(threads)
+    {
+    }
+
+    void separate()
+    {
+        if (_separate && !_first) _writer->raw(',').newline();
+        _first = false;
+    }
+
+    // Write bt on this thread
+    static void write_one(Transform &ft, JsonWriter *writer, libdap::BaseType *bt, const std::string &indent,
+        bool sendData)
+    {
+        BESDEBUG("fojson", "VariableWriter - Processing variable: " << bt->name() << std::endl);
+        ft.transform(writer, bt, indent, sendData);
+        if (sendData) ft.release_written(bt);
+    }
+
+    // Is bt written on one of the threads? Metadata does not grow with the
+    // values, so all of it is.
+    static bool on_thread(libdap::BaseType *bt, bool sendData)
+    {
+        return !sendData || variable_bytes(bt) <= max_task_bytes;
+    }
+
+    // Write the text of the oldest variable the threads have written
+    void write_next()
+    {
+        VariableTask *task = static_cast<VariableTask *>(_tasks.next());
+        try {
+            separate();
+            _writer->raw(task->output.str());
+            _writer->checkpoint();
+        }
+        catch (...) {
+            delete task;
+            throw;
+        }
+        delete task;
+    }
+
+    void write_on_threads(const std::vector<libdap::BaseType *> &vars)
+    {
+        for (std::vector<libdap::BaseType *>::size_type i = 0; i < vars.size(); i++) {
+            if (!on_thread(vars[i], _send_data)) {
+                while (_tasks.size())
+                    write_next();
+                separate();
+                write_one(_ft, _writer, vars[i], _indent, _send_data);
+                continue;
+            }
+
+            _tasks.submit(new VariableTask(_copies, vars[i], _indent, _send_data));
+            while (_tasks.size() > 2 * _tasks.threads())
+                write_next();
+        }
+        while (_tasks.size())
+            write_next();
+    }
+
+    VariableWriter(const VariableWriter &);
+    VariableWriter &operator=(const VariableWriter &);
+
+public:
+    /**
+     * @param ft The transform that writes the variables
+     * @param writer Write the variables here
+     * @param vars The variables
+     * @param indent The indent of each variable
+     * @param sendData True to write data, false for metadata
+     * @param separate True to separate the variables with commas
+     */
+    static void write(Transform &ft, JsonWriter *writer, const std::vector<libdap::BaseType *> &vars,
+        const std::string &indent, bool sendData, bool separate)
+    {
+        unsigned int tasks = 0;
+        if (ft._threads > 1 && !ft._eval && !vars.empty() && !vars[0]->get_parent() && !has_sequence(ft._dds)) {
+            for (std::vector<libdap::BaseType *>::size_type i = 0; i < vars.size(); i++)
+                if (on_thread(vars[i], sendData)) tasks++;
+        }
+
+        unsigned int threads = std::min(ft._threads, tasks);
+        if (threads > 1 && BESISDEBUG("fojson")) {
+            BESDEBUG("fojson", "VariableWriter - Writing " << vars.size() << " variables on this thread while"
+                " debugging" << std::endl);
+            threads = 1;
+        }
+        if (threads < 2) {
+            for (std::vector<libdap::BaseType *>::size_type i = 0; i < vars.size(); i++) {
+                if (separate && i > 0) writer->raw(',').newline();
+                write_one(ft, writer, vars[i], indent, sendData);
+            }
+            return;
+        }
+
+        BESDEBUG("fojson", "VariableWriter - Writing " << tasks << " of " << vars.size() << " variables on "
+            << threads << " threads" << std::endl);
+
+        VariableWriter vw(ft, writer, indent, sendData, separate, threads);
+        vw.write_on_threads(vars);
+    }
+};
+
+} // namespace fojson
+
+#endif /* FOJSON_VARIABLEWRITER_H_ */
@@ -0,0 +1,215 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+//
+// ZstdStream.cc
+//
+// This file is part of BES JSON File Out Module
+//
+// Copyright (c) 2014 OPeNDAP, Inc.
+// Author: Nathan Potter <ndp@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+// (c) COPYRIGHT URI/MIT 1995-1999
+// Please read the full copyright statement in the file COPYRIGHT_URI.
+//
+
+
+#include "config.h"
+
+// Listed in every build so that Makefile.am needs no automake conditional
+// for zstd (BES's configure does not define one for in-tree builds); it is
+// empty unless configure found zstd.
+#ifdef HAVE_ZSTD
+
+#include <fstream>
+
+#include <BESInternalError.h>
+#include <BESDebug.h>
+
+#include "ZstdStream.h"
+#include "StreamFailed.h"
+
+namespace fojson {
+
+ZstdDictionary *ZstdDictionary::d_instance = 0;
+
+/// Get the dictionary; load() it before it is used
+ZstdDictionary *ZstdDictionary::TheDictionary()
+{
+    if (!d_instance) d_instance = new ZstdDictionary;
+    return d_instance;
+}
+
+/// Free the dictionary
+void ZstdDictionary::delete_instance()
+{
+    delete d_instance;
+    d_instance = 0;
+}
+
+ZstdDictionary::~ZstdDictionary()
+{
+    ZSTD_freeCDict(_cdict);
+}
+
+/**
+ * Read the dictionary from a file, replacing any loaded before.
+ *
+ * @param file_name A dictionary made by 'zstd --train'
+ * @throws BESInternalError if the file cannot be read
+ */
+void ZstdDictionary::load(const std::string &file_name)
+{
+    std::ifstream in(file_name.c_str(), std::ios::binary);
+    std::vector<char> dictionary((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (!in || dictionary.empty())
+        throw BESInternalError("File out JSON, could not read the zstd dictionary " + file_name, __FILE__, __LINE__);
+
+    _dictionary.swap(dictionary);
+    ZSTD_freeCDict(_cdict);
+    _cdict = 0;
+
+    BESDEBUG("fojson", "ZstdDictionary::load() - loaded " << file_name << ", id " << ZSTD_getDictID_fromDict(&_dictionary[0], _dictionary.size()) << std::endl);
+}
+
+/**
+ * Get the dictionary digested for a compression level.
+ *
+ * @param level zstd compression level
+ * @return The digested dictionary, or null if none has been loaded
+ * @throws BESInternalError if the dictionary cannot be digested
+ */
+const ZSTD_CDict *ZstdDictionary::get_cdict(int level)
+{
+    if (!loaded()) return 0;
+
+    if (!_cdict || _cdict_level != level) {
+        ZSTD_freeCDict(_cdict);
+        _cdict = ZSTD_createCDict(&_dictionary[0], _dictionary.size(), level);
+        if (!_cdict) throw BESInternalError("File out JSON, could not use the zstd dictionary.", __FILE__, __LINE__);
+        _cdict_level = level;
+    }
+
+    return _cdict;
+}
+
+/**
+ * @param strm Write the compressed data to this stream
+ * @param level zstd compression level; 0 is zstd's default
+ * @param cdict Compress with this dictionary; null for none
+ * @param workers Compress on this many threads; 0 to compress on the
+ * calling thread. Ignored if the zstd library was built without threads.
+ * @throws BESInternalError if zstd cannot be initialized
+ */
+ZstdStreambuf::ZstdStreambuf(std::ostream &strm, int level, const ZSTD_CDict *cdict, unsigned int workers) :
+    _strm(strm), _cctx(ZSTD_createCCtx()), _in(ZSTD_CStreamInSize()), _out(ZSTD_CStreamOutSize()), _finished(false)
+{
+    if (!_cctx
+        || ZSTD_isError(ZSTD_CCtx_setParameter(_cctx, ZSTD_c_compressionLevel, level))
+        || (cdict && ZSTD_isError(ZSTD_CCtx_refCDict(_cctx, cdict)))) {
+        ZSTD_freeCCtx(_cctx);
+        throw BESInternalError("File out JSON, could not initialize zstd compression.", __FILE__, __LINE__);
+    }
+
+    if (workers > 0 && ZSTD_isError(ZSTD_CCtx_setParameter(_cctx, ZSTD_c_nbWorkers, workers)))
+        BESDEBUG("fojson", "ZstdStreambuf - zstd was built without threads; compressing on one thread" << std::endl);
+
+    setp(&_in[0], &_in[0] + _in.size());
+}
+
+ZstdStreambuf::~ZstdStreambuf()
+{
+    ZSTD_freeCCtx(_cctx);
+}
+
+// Compress n bytes, writing the compressed data to the stream each time the
+// output buffer fills. A flush or end is complete when zstd reports that
+// nothing is left to write.
+void ZstdStreambuf::compress_input(const char *s, size_t n, ZSTD_EndDirective mode)
+{
+    ZSTD_inBuffer input = { s, n, 0 };
+    size_t remaining;
+    do {
+        ZSTD_outBuffer output = { &_out[0], _out.size(), 0 };
+        remaining = ZSTD_compressStream2(_cctx, &output, &input, mode);
+        if (ZSTD_isError(remaining))
+            throw BESInternalError(std::string("File out JSON, zstd compression failed: ") + ZSTD_getErrorName(remaining),
+                __FILE__, __LINE__);
+
+        if (output.pos && !_strm.write(&_out[0], output.pos))
+            throw StreamFailed();
+    } while (mode == ZSTD_e_continue ? input.pos < input.size : remaining != 0);
+}
+
+// Compress what has been written to the input buffer and empty it
+void ZstdStreambuf::compress_buffer(ZSTD_EndDirective mode)
+{
+    compress_input(pbase(), pptr() - pbase(), mode);
+    setp(&_in[0], &_in[0] + _in.size());
+}
+
+ZstdStreambuf::int_type ZstdStreambuf::overflow(int_type c)
+{
+    if (_finished) throw BESInternalError("File out JSON, write after the end of the compressed response.", __FILE__, __LINE__);
+
+    compress_buffer(ZSTD_e_continue);
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+
+    return traits_type::not_eof(c);
+}
+
+// Blocks larger than the input buffer are compressed in place rather than
+// copied into it first.
+std::streamsize ZstdStreambuf::xsputn(const char *s, std::streamsize n)
+{
+    if (n < epptr() - pptr()) return std::streambuf::xsputn(s, n);
+
+    if (_finished) throw BESInternalError("File out JSON, write after the end of the compressed response.", __FILE__, __LINE__);
+
+    compress_buffer(ZSTD_e_continue);
+    compress_input(s, n, ZSTD_e_continue);
+
+    return n;
+}
+
+// Make everything written so far decodable by the client
+int ZstdStreambuf::sync()
+{
+    if (!_finished) compress_buffer(ZSTD_e_flush);
+    _strm.flush();
+
+    return _strm ? 0 : -1;
+}
+
+/**
+ * Compress anything still buffered, end the zstd frame and flush the
+ * underlying stream. Nothing may be written after this.
+ */
+void ZstdStreambuf::finish()
+{
+    if (_finished) return;
+
+    compress_buffer(ZSTD_e_end);
+    _finished = true;
+    _strm.flush();
+}
+
+} // namespace fojson
+
+#endif // HAVE_ZSTD
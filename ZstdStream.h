@@ -0,0 +1,144 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+//
+// ZstdStream.h
+//
+// This file is part of BES JSON File Out Module
+//
+// Copyright (c) 2014 OPeNDAP, Inc.
+// Author: Nathan Potter <ndp@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+// (c) COPYRIGHT URI/MIT 1995-1999
+// Please read the full copyright statement in the file COPYRIGHT_URI.
+//
+
+#ifndef FOJSON_ZSTDSTREAM_H_
+#define FOJSON_ZSTDSTREAM_H_ 1
+
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <zstd.h>
+
+namespace fojson {
+
+/**
+ * @brief The zstd dictionary used to compress metadata responses.
+ *
+ * The dictionary was trained on the module's own metadata responses (see
+ * the zstd-dictionary target in Makefile.am); the attribute and property
+ * names that fill those small documents are in it, so they compress far
+ * better than they do on their own. A client needs the same dictionary to
+ * decompress them.
+ *
+ * FoJsonModule::initialize() loads the dictionary file. It is digested
+ * for a compression level the first time it is used at that level.
+ */
+class ZstdDictionary {
+private:
+    std::vector<char> _dictionary;
+    ZSTD_CDict *_cdict;
+    int _cdict_level;
+
+    static ZstdDictionary *d_instance;
+
+    ZstdDictionary() : _cdict(0), _cdict_level(0) { }
+    ZstdDictionary(const ZstdDictionary &);
+    ZstdDictionary &operator=(const ZstdDictionary &);
+
+public:
+    virtual ~ZstdDictionary();
+
+    void load(const std::string &file_name);
+
+    /// Has a dictionary been loaded?
+    bool loaded() const { return !_dictionary.empty(); }
+
+    const ZSTD_CDict *get_cdict(int level);
+
+    static ZstdDictionary *TheDictionary();
+    static void delete_instance();
+};
+
+/**
+ * @brief A streambuf that compresses with zstd what is written to it and
+ * passes the compressed bytes on to another stream.
+ *
+ * This works like DeflateStreambuf: the buffers have a fixed size, sync()
+ * makes everything written so far decodable, finish() ends the frame.
+ * Given worker threads, zstd compresses parts of the frame on them in
+ * parallel.
+ */
+class ZstdStreambuf: public std::streambuf {
+private:
+    std::ostream &_strm;
+    ZSTD_CCtx *_cctx;
+    std::vector<char> _in;
+    std::vector<char> _out;
+    bool _finished;
+
+    void compress_input(const char *s, size_t n, ZSTD_EndDirective mode);
+    void compress_buffer(ZSTD_EndDirective mode);
+
+    ZstdStreambuf(const ZstdStreambuf &);
+    ZstdStreambuf &operator=(const ZstdStreambuf &);
+
+protected:
+    virtual int_type overflow(int_type c);
+    virtual std::streamsize xsputn(const char *s, std::streamsize n);
+    virtual int sync();
+
+public:
+    ZstdStreambuf(std::ostream &strm, int level, const ZSTD_CDict *cdict, unsigned int workers = 0);
+    virtual ~ZstdStreambuf();
+
+    void finish();
+};
+
+/**
+ * @brief An output stream that compresses with a ZstdStreambuf.
+ */
+class ZstdStream: public std::ostream {
+private:
+    ZstdStreambuf _buf;
+
+public:
+    /**
+     * @param strm Write the compressed data to this stream
+     * @param level zstd compression level; 0 is zstd's default
+     * @param cdict Compress with this dictionary; null for none
+     * @param workers Compress on this many threads; 0 to compress on the
+     * calling thread
+     */
+    ZstdStream(std::ostream &strm, int level, const ZSTD_CDict *cdict = 0, unsigned int workers = 0) :
+        std::ostream(0), _buf(strm, level, cdict, workers)
+    {
+        rdbuf(&_buf);
+        exceptions(std::ios::badbit);
+    }
+
+    virtual ~ZstdStream() { }
+
+    /// Write the end of the zstd frame and flush the underlying stream
+    void finish() { _buf.finish(); }
+};
+
+} // namespace fojson
+
+#endif /* FOJSON_ZSTDSTREAM_H_ */
@@ -0,0 +1,1214 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+//
+// fojson_format.cc
+//
+// This file is part of BES JSON File Out Module
+//
+// Copyright (c) 2014 OPeNDAP, Inc.
+// Author: Nathan Potter <ndp@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+// (c) COPYRIGHT URI/MIT 1995-1999
+// Please read the full copyright statement in the file COPYRIGHT_URI.
+//
+
+
+#include "config.h"
+
+#include <stdint.h>
+#include <cstring>
+#include <limits>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <BaseType.h>
+#include <Byte.h>
+#include <Int16.h>
+#include <UInt16.h>
+#include <Int32.h>
+#include <UInt32.h>
+#include <Float32.h>
+#include <Float64.h>
+#include <Str.h>
+
+#include <BESInternalError.h>
+
+#include "fojson_format.h"
+#include "fojson_utils.h"
+#include "JsonWriter.h"
+
+// std::to_chars() for floating point types is an implementation of Ryu; it
+// produces the shortest string that reads back as the same value. When the
+// library does not have it we use the Grisu2 implementation below.
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#define FOJSON_HAVE_FP_TO_CHARS 1
+#endif
+
+namespace fojson {
+
+namespace {
+
+// Format a value with the shortest representation that reads back exactly
+struct shortest_format {
+    template<typename T>
+    char *operator()(char *buf, T value) const
+    {
+        return format_number(buf, value);
+    }
+};
+
+// Format a floating point value rounded to a number of significant digits
+struct rounded_format {
+    int precision;
+
+    explicit rounded_format(int p) : precision(p) { }
+
+    template<typename T>
+    char *operator()(char *buf, T value) const
+    {
+        return format_number(buf, value, precision);
+    }
+};
+
+/**
+ * Write 'count' values as a comma separated list, formatting each one
+ * straight into the writer's buffer.
+ */
+template<typename T, typename Format>
+void write_number_values(JsonWriter *writer, const T *values, unsigned int count, Format format)
+{
+    const bool compact = writer->compact();
+
+    for (unsigned int i = 0; i < count; i++) {
+        char *p = writer->reserve(max_number_chars + 2);
+        if (i) {
+            *p++ = ',';
+            if (!compact) *p++ = ' ';
+        }
+        writer->commit(format(p, values[i]));
+    }
+}
+
+/**
+ * Like write_number_values(), but values for which is_finite() is false
+ * are written as the 'non_finite' string.
+ */
+template<typename T, typename Format>
+void write_checked_values(JsonWriter *writer, const T *values, unsigned int count, const std::string &non_finite,
+    Format format)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        if (i) writer->separator();
+        if (is_finite(values[i]))
+            writer->commit(format(writer->reserve(max_number_chars), values[i]));
+        else
+            writer->raw(non_finite);
+    }
+}
+
+// Number of vectors tested between checks of the accumulated result
+const unsigned int finite_scan_block = 16;
+
+#ifdef __SSE2__
+/*
+ * For finite x, x - x is zero; for NaN and +/-Inf it is NaN. Comparing the
+ * difference with itself as 'unordered' gives a lane of ones for each
+ * non-finite value. The lanes are or'ed together and looked at once per
+ * block so that the loop has no data dependent branches.
+ */
+unsigned int sse2_finite_prefix(const float *values, unsigned int count)
+{
+    const unsigned int step = 4 * finite_scan_block;
+    unsigned int i = 0;
+    for (; i + step <= count; i += step) {
+        __m128 acc = _mm_setzero_ps();
+        for (unsigned int j = 0; j < step; j += 4) {
+            __m128 v = _mm_loadu_ps(values + i + j);
+            __m128 d = _mm_sub_ps(v, v);
+            acc = _mm_or_ps(acc, _mm_cmpunord_ps(d, d));
+        }
+        if (_mm_movemask_ps(acc)) break;
+    }
+    return i;
+}
+
+unsigned int sse2_finite_prefix(const double *values, unsigned int count)
+{
+    const unsigned int step = 2 * finite_scan_block;
+    unsigned int i = 0;
+    for (; i + step <= count; i += step) {
+        __m128d acc = _mm_setzero_pd();
+        for (unsigned int j = 0; j < step; j += 2) {
+            __m128d v = _mm_loadu_pd(values + i + j);
+            __m128d d = _mm_sub_pd(v, v);
+            acc = _mm_or_pd(acc, _mm_cmpunord_pd(d, d));
+        }
+        if (_mm_movemask_pd(acc)) break;
+    }
+    return i;
+}
+#endif
+
+template<typename T>
+bool all_finite_values(const T *values, unsigned int count)
+{
+    unsigned int i = 0;
+#ifdef __SSE2__
+    i = sse2_finite_prefix(values, count);
+#endif
+    bool finite = true;
+    for (; i < count; i++)
+        finite &= is_finite(values[i]);
+
+    return finite;
+}
+
+/*
+ * Round the shortest digits of a value to 'precision' significant digits
+ * (half up) and lay them out the way printf()'s %.*g does: scientific
+ * notation when the exponent is less than -4 or not less than the
+ * precision, trailing zeros removed.
+ *
+ * Because the shortest digits are rounded, and not the exact binary value,
+ * this never writes more digits than are needed to read back the value
+ * (printf("%.9g", 0.1f) gives 0.100000001) and rounds a trailing '5' up.
+ */
+char *format_rounded_digits(char *buf, char *digits, int len, int decimal_exponent, int precision)
+{
+    if (len > precision) {
+        decimal_exponent += len - precision;
+        const bool round_up = digits[precision] >= '5';
+        len = precision;
+        if (round_up) {
+            int i = len - 1;
+            while (i >= 0 && digits[i] == '9')
+                digits[i--] = '0';
+            if (i >= 0) {
+                digits[i]++;
+            }
+            else {
+                // 99.9 -> 100
+                digits[0] = '1';
+                decimal_exponent += len;
+                len = 1;
+            }
+        }
+    }
+    while (len > 1 && digits[len - 1] == '0') {
+        len--;
+        decimal_exponent++;
+    }
+
+    const int exp10 = len + decimal_exponent - 1;
+    if (exp10 < -4 || exp10 >= precision) {
+        const int abs_exp10 = exp10 < 0 ? -exp10 : exp10;
+        *buf++ = digits[0];
+        if (len > 1) {
+            *buf++ = '.';
+            memcpy(buf, digits + 1, len - 1);
+            buf += len - 1;
+        }
+        *buf++ = 'e';
+        *buf++ = exp10 < 0 ? '-' : '+';
+        if (abs_exp10 >= 100) {
+            *buf++ = char('0' + abs_exp10 / 100);
+        }
+        *buf++ = char('0' + (abs_exp10 / 10) % 10);
+        *buf++ = char('0' + abs_exp10 % 10);
+        return buf;
+    }
+
+    const int k = exp10 + 1;
+    if (k <= 0) {
+        *buf++ = '0';
+        *buf++ = '.';
+        for (int i = 0; i < -k; i++)
+            *buf++ = '0';
+        memcpy(buf, digits, len);
+        return buf + len;
+    }
+    if (k < len) {
+        memcpy(buf, digits, k);
+        buf[k] = '.';
+        memcpy(buf + k + 1, digits + k, len - k);
+        return buf + len + 1;
+    }
+    memcpy(buf, digits, len);
+    for (int i = len; i < k; i++)
+        buf[i] = '0';
+    return buf + k;
+}
+
+#ifdef FOJSON_HAVE_FP_TO_CHARS
+/*
+ * Get the shortest digits from std::to_chars() in scientific notation,
+ * [-]d[.ddd]e(+|-)dd[d], and round them.
+ */
+template<typename T>
+char *format_rounded(char *buf, T value, int precision)
+{
+    char sci[max_number_chars];
+    const char *end = std::to_chars(sci, sci + max_number_chars, value, std::chars_format::scientific).ptr;
+    const char *p = sci;
+    if (*p == '-') *buf++ = *p++;
+
+    char digits[max_number_chars];
+    int len = 0;
+    for (; *p != 'e'; p++)
+        if (*p != '.') digits[len++] = *p;
+
+    const bool negative_exp = p[1] == '-';
+    int exp10 = 0;
+    for (p += 2; p != end; p++)
+        exp10 = exp10 * 10 + (*p - '0');
+    if (negative_exp) exp10 = -exp10;
+
+    return format_rounded_digits(buf, digits, len, exp10 - len + 1, precision);
+}
+#endif
+
+#ifndef FOJSON_HAVE_FP_TO_CHARS
+/*
+ * Grisu2, from Florian Loitsch, "Printing Floating-Point Numbers Quickly and
+ * Accurately with Integers", PLDI 2010. The digits always read back to the
+ * same value and are the shortest possible for all but a tiny fraction of
+ * inputs. The output layout matches std::to_chars(): fixed or scientific
+ * notation, whichever is shorter.
+ */
+
+// A floating point number f * 2^e with a 64-bit significand
+struct diyfp {
+    uint64_t f;
+    int e;
+
+    diyfp(uint64_t f_, int e_) : f(f_), e(e_) { }
+};
+
+// x - y; both must have the same exponent and x.f >= y.f
+diyfp diyfp_sub(const diyfp &x, const diyfp &y)
+{
+    return diyfp(x.f - y.f, x.e);
+}
+
+// x * y, rounded to 64 bits
+diyfp diyfp_mul(const diyfp &x, const diyfp &y)
+{
+    const uint64_t u_lo = x.f & 0xFFFFFFFFu;
+    const uint64_t u_hi = x.f >> 32;
+    const uint64_t v_lo = y.f & 0xFFFFFFFFu;
+    const uint64_t v_hi = y.f >> 32;
+
+    const uint64_t p0 = u_lo * v_lo;
+    const uint64_t p1 = u_lo * v_hi;
+    const uint64_t p2 = u_hi * v_lo;
+    const uint64_t p3 = u_hi * v_hi;
+
+    uint64_t q = (p0 >> 32) + (p1 & 0xFFFFFFFFu) + (p2 & 0xFFFFFFFFu);
+    q += uint64_t(1) << 31; // round, ties up
+
+    return diyfp(p3 + (p2 >> 32) + (p1 >> 32) + (q >> 32), x.e + y.e + 64);
+}
+
+diyfp diyfp_normalize(diyfp x)
+{
+    while ((x.f >> 63) == 0) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+diyfp diyfp_normalize_to(const diyfp &x, int e)
+{
+    return diyfp(x.f << (x.e - e), e);
+}
+
+/*
+ * Compute the (normalized) value and the boundaries m- and m+ of the
+ * interval of real numbers that round to 'value' when read back as a T.
+ * Using the precision of T here (and not that of double) is what makes
+ * the digits for a float the shortest ones for a float.
+ */
+template<typename T, typename Bits>
+void compute_boundaries(T value, diyfp &w, diyfp &w_minus, diyfp &w_plus)
+{
+    const int precision = std::numeric_limits<T>::digits;
+    const int bias = std::numeric_limits<T>::max_exponent - 1 + (precision - 1);
+    const int min_exp = 1 - bias;
+    const Bits hidden_bit = Bits(1) << (precision - 1);
+
+    Bits bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint64_t F = bits & (hidden_bit - 1);
+    const uint64_t E = bits >> (precision - 1);
+
+    const diyfp v = (E == 0) ? diyfp(F, min_exp) : diyfp(F + hidden_bit, int(E) - bias);
+
+    // The lower boundary is closer when F is zero, except for the smallest normal
+    const bool lower_boundary_is_closer = (F == 0 && E > 1);
+    const diyfp m_plus(2 * v.f + 1, v.e - 1);
+    const diyfp m_minus = lower_boundary_is_closer ? diyfp(4 * v.f - 1, v.e - 2) : diyfp(2 * v.f - 1, v.e - 1);
+
+    w_plus = diyfp_normalize(m_plus);
+    w_minus = diyfp_normalize_to(m_minus, w_plus.e);
+    w = diyfp_normalize(v);
+}
+
+// Normalized 64-bit approximations of 10^k, f * 2^e, for every 8th k
+struct cached_power {
+    uint64_t f;
+    int e;
+    int k;
+};
+
+const int cached_powers_min_dec_exp = -300;
+const int cached_powers_dec_step = 8;
+
+const cached_power cached_powers[] = {
+    { 0xAB70FE17C79AC6CAULL, -1060, -300 },
+    { 0xFF77B1FCBEBCDC4FULL, -1034, -292 },
+    { 0xBE5691EF416BD60CULL, -1007, -284 },
+    { 0x8DD01FAD907FFC3CULL,  -980, -276 },
+    { 0xD3515C2831559A83ULL,  -954, -268 },
+    { 0x9D71AC8FADA6C9B5ULL,  -927, -260 },
+    { 0xEA9C227723EE8BCBULL,  -901, -252 },
+    { 0xAECC49914078536DULL,  -874, -244 },
+    { 0x823C12795DB6CE57ULL,  -847, -236 },
+    { 0xC21094364DFB5637ULL,  -821, -228 },
+    { 0x9096EA6F3848984FULL,  -794, -220 },
+    { 0xD77485CB25823AC7ULL,  -768, -212 },
+    { 0xA086CFCD97BF97F4ULL,  -741, -204 },
+    { 0xEF340A98172AACE5ULL,  -715, -196 },
+    { 0xB23867FB2A35B28EULL,  -688, -188 },
+    { 0x84C8D4DFD2C63F3BULL,  -661, -180 },
+    { 0xC5DD44271AD3CDBAULL,  -635, -172 },
+    { 0x936B9FCEBB25C996ULL,  -608, -164 },
+    { 0xDBAC6C247D62A584ULL,  -582, -156 },
+    { 0xA3AB66580D5FDAF6ULL,  -555, -148 },
+    { 0xF3E2F893DEC3F126ULL,  -529, -140 },
+    { 0xB5B5ADA8AAFF80B8ULL,  -502, -132 },
+    { 0x87625F056C7C4A8BULL,  -475, -124 },
+    { 0xC9BCFF6034C13053ULL,  -449, -116 },
+    { 0x964E858C91BA2655ULL,  -422, -108 },
+    { 0xDFF9772470297EBDULL,  -396, -100 },
+    { 0xA6DFBD9FB8E5B88FULL,  -369,  -92 },
+    { 0xF8A95FCF88747D94ULL,  -343,  -84 },
+    { 0xB94470938FA89BCFULL,  -316,  -76 },
+    { 0x8A08F0F8BF0F156BULL,  -289,  -68 },
+    { 0xCDB02555653131B6ULL,  -263,  -60 },
+    { 0x993FE2C6D07B7FACULL,  -236,  -52 },
+    { 0xE45C10C42A2B3B06ULL,  -210,  -44 },
+    { 0xAA242499697392D3ULL,  -183,  -36 },
+    { 0xFD87B5F28300CA0EULL,  -157,  -28 },
+    { 0xBCE5086492111AEBULL,  -130,  -20 },
+    { 0x8CBCCC096F5088CCULL,  -103,  -12 },
+    { 0xD1B71758E219652CULL,   -77,   -4 },
+    { 0x9C40000000000000ULL,   -50,    4 },
+    { 0xE8D4A51000000000ULL,   -24,   12 },
+    { 0xAD78EBC5AC620000ULL,     3,   20 },
+    { 0x813F3978F8940984ULL,    30,   28 },
+    { 0xC097CE7BC90715B3ULL,    56,   36 },
+    { 0x8F7E32CE7BEA5C70ULL,    83,   44 },
+    { 0xD5D238A4ABE98068ULL,   109,   52 },
+    { 0x9F4F2726179A2245ULL,   136,   60 },
+    { 0xED63A231D4C4FB27ULL,   162,   68 },
+    { 0xB0DE65388CC8ADA8ULL,   189,   76 },
+    { 0x83C7088E1AAB65DBULL,   216,   84 },
+    { 0xC45D1DF942711D9AULL,   242,   92 },
+    { 0x924D692CA61BE758ULL,   269,  100 },
+    { 0xDA01EE641A708DEAULL,   295,  108 },
+    { 0xA26DA3999AEF774AULL,   322,  116 },
+    { 0xF209787BB47D6B85ULL,   348,  124 },
+    { 0xB454E4A179DD1877ULL,   375,  132 },
+    { 0x865B86925B9BC5C2ULL,   402,  140 },
+    { 0xC83553C5C8965D3DULL,   428,  148 },
+    { 0x952AB45CFA97A0B3ULL,   455,  156 },
+    { 0xDE469FBD99A05FE3ULL,   481,  164 },
+    { 0xA59BC234DB398C25ULL,   508,  172 },
+    { 0xF6C69A72A3989F5CULL,   534,  180 },
+    { 0xB7DCBF5354E9BECEULL,   561,  188 },
+    { 0x88FCF317F22241E2ULL,   588,  196 },
+    { 0xCC20CE9BD35C78A5ULL,   614,  204 },
+    { 0x98165AF37B2153DFULL,   641,  212 },
+    { 0xE2A0B5DC971F303AULL,   667,  220 },
+    { 0xA8D9D1535CE3B396ULL,   694,  228 },
+    { 0xFB9B7CD9A4A7443CULL,   720,  236 },
+    { 0xBB764C4CA7A44410ULL,   747,  244 },
+    { 0x8BAB8EEFB6409C1AULL,   774,  252 },
+    { 0xD01FEF10A657842CULL,   800,  260 },
+    { 0x9B10A4E5E9913129ULL,   827,  268 },
+    { 0xE7109BFBA19C0C9DULL,   853,  276 },
+    { 0xAC2820D9623BF429ULL,   880,  284 },
+    { 0x80444B5E7AA7CF85ULL,   907,  292 },
+    { 0xBF21E44003ACDD2DULL,   933,  300 },
+    { 0x8E679C2F5E44FF8FULL,   960,  308 },
+    { 0xD433179D9C8CB841ULL,   986,  316 },
+    { 0x9E19DB92B4E31BA9ULL,  1013,  324 },
+    { 0xEB96BF6EBADF77D9ULL,  1039,  332 },
+    { 0xAF87023B9BF0EE6BULL,  1066,  340 }
+};
+
+// Bounds on the binary exponent of the scaled value; see Loitsch, section 5.
+const int grisu_alpha = -60;
+const int grisu_gamma = -32;
+
+const cached_power &get_cached_power_for_binary_exponent(int e)
+{
+    // 78913 / 2^18 approximates log10(2)
+    const int f = grisu_alpha - e - 1;
+    const int k = (f * 78913) / (1 << 18) + (f > 0 ? 1 : 0);
+    const int index = (-cached_powers_min_dec_exp + k + (cached_powers_dec_step - 1)) / cached_powers_dec_step;
+
+    return cached_powers[index];
+}
+
+// The number of decimal digits in n and the largest power of ten <= n.
+int find_largest_pow10(uint32_t n, uint32_t &pow10)
+{
+    uint32_t p = 1000000000;
+    for (int digits = 10; digits > 1; digits--, p /= 10) {
+        if (n >= p) {
+            pow10 = p;
+            return digits;
+        }
+    }
+    pow10 = 1;
+    return 1;
+}
+
+void grisu2_round(char *buf, int len, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t ten_k)
+{
+    // Move the last digit down while that gets closer to w and stays inside
+    // the rounding interval.
+    while (rest < dist && delta - rest >= ten_k && (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+        buf[len - 1]--;
+        rest += ten_k;
+    }
+}
+
+/*
+ * Generate the digits of v = w * 10^-k. On return buf holds 'len' digits
+ * and the value is buf * 10^decimal_exponent.
+ */
+void grisu2_digit_gen(char *buf, int &len, int &decimal_exponent, const diyfp &M_minus, const diyfp &w,
+    const diyfp &M_plus)
+{
+    uint64_t delta = diyfp_sub(M_plus, M_minus).f;
+    uint64_t dist = diyfp_sub(M_plus, w).f;
+
+    const diyfp one(uint64_t(1) << -M_plus.e, M_plus.e);
+
+    uint32_t p1 = uint32_t(M_plus.f >> -one.e);
+    uint64_t p2 = M_plus.f & (one.f - 1);
+
+    // The integral part
+    uint32_t pow10;
+    int n = find_largest_pow10(p1, pow10);
+    while (n > 0) {
+        const uint32_t d = p1 / pow10;
+        p1 = p1 % pow10;
+        buf[len++] = char('0' + d);
+        n--;
+
+        const uint64_t rest = (uint64_t(p1) << -one.e) + p2;
+        if (rest <= delta) {
+            decimal_exponent += n;
+            grisu2_round(buf, len, dist, delta, rest, uint64_t(pow10) << -one.e);
+            return;
+        }
+        pow10 /= 10;
+    }
+
+    // The fractional part
+    int m = 0;
+    for (;;) {
+        p2 *= 10;
+        const uint64_t d = p2 >> -one.e;
+        p2 &= one.f - 1;
+        buf[len++] = char('0' + d);
+        m++;
+
+        delta *= 10;
+        dist *= 10;
+        if (p2 <= delta) break;
+    }
+    decimal_exponent -= m;
+    grisu2_round(buf, len, dist, delta, p2, one.f);
+}
+
+// Write the digits of a positive, finite value
+template<typename T, typename Bits>
+void grisu2(char *buf, int &len, int &decimal_exponent, T value)
+{
+    diyfp w(0, 0), m_minus(0, 0), m_plus(0, 0);
+    compute_boundaries<T, Bits>(value, w, m_minus, m_plus);
+
+    const cached_power &cached = get_cached_power_for_binary_exponent(m_plus.e);
+    const diyfp c_minus_k(cached.f, cached.e);
+
+    const diyfp W = diyfp_mul(w, c_minus_k);
+    const diyfp W_minus = diyfp_mul(m_minus, c_minus_k);
+    const diyfp W_plus = diyfp_mul(m_plus, c_minus_k);
+
+    // Shrink the interval by one ulp on each side to stay safely inside it
+    const diyfp M_minus(W_minus.f + 1, W_minus.e);
+    const diyfp M_plus(W_plus.f - 1, W_plus.e);
+
+    len = 0;
+    decimal_exponent = -cached.k;
+    grisu2_digit_gen(buf, len, decimal_exponent, M_minus, W, M_plus);
+}
+
+/*
+ * Lay out 'len' digits with value digits * 10^decimal_exponent the way
+ * std::to_chars() does: fixed notation unless scientific is shorter. Like
+ * std::to_chars(), integers wider than the shortest digits are written with
+ * their exact value (when it fits in 64 bits) rather than padded with zeros.
+ */
+char *format_digits(char *buf, const char *digits, int len, int decimal_exponent, double value)
+{
+    // Position of the decimal point relative to the first digit
+    const int k = len + decimal_exponent;
+    const int exp10 = k - 1;
+    const int abs_exp10 = exp10 < 0 ? -exp10 : exp10;
+
+    const int fixed_len = (k <= 0) ? 2 - k + len : (k < len ? len + 1 : k);
+    const int sci_len = len + (len > 1 ? 1 : 0) + 2 + (abs_exp10 >= 100 ? 3 : 2);
+
+    if (fixed_len <= sci_len) {
+        if (k <= 0) {
+            *buf++ = '0';
+            *buf++ = '.';
+            for (int i = 0; i < -k; i++)
+                *buf++ = '0';
+            memcpy(buf, digits, len);
+            return buf + len;
+        }
+        if (k < len) {
+            memcpy(buf, digits, k);
+            buf[k] = '.';
+            memcpy(buf + k + 1, digits + k, len - k);
+            return buf + len + 1;
+        }
+        if (k > len && value < 18446744073709551616.0) {
+            uint64_t n = uint64_t(value);
+            for (int i = k - 1; i >= 0; i--, n /= 10)
+                buf[i] = char('0' + n % 10);
+            return buf + k;
+        }
+        memcpy(buf, digits, len);
+        for (int i = len; i < k; i++)
+            buf[i] = '0';
+        return buf + k;
+    }
+
+    *buf++ = digits[0];
+    if (len > 1) {
+        *buf++ = '.';
+        memcpy(buf, digits + 1, len - 1);
+        buf += len - 1;
+    }
+    *buf++ = 'e';
+    *buf++ = exp10 < 0 ? '-' : '+';
+    if (abs_exp10 >= 100) {
+        *buf++ = char('0' + abs_exp10 / 100);
+    }
+    *buf++ = char('0' + (abs_exp10 / 10) % 10);
+    *buf++ = char('0' + abs_exp10 % 10);
+
+    return buf;
+}
+
+// With a precision of 0 the shortest representation is written
+template<typename T, typename Bits>
+char *format_floating_point(char *buf, T value, int precision)
+{
+    if (value != value) {
+        memcpy(buf, "nan", 3);
+        return buf + 3;
+    }
+    Bits bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if (bits >> (sizeof(bits) * 8 - 1)) {
+        *buf++ = '-';
+        value = -value;
+    }
+    if (value == 0) {
+        *buf++ = '0';
+        return buf;
+    }
+    if (value > std::numeric_limits<T>::max()) {
+        memcpy(buf, "inf", 3);
+        return buf + 3;
+    }
+
+    char digits[max_number_chars];
+    int len;
+    int decimal_exponent;
+    grisu2<T, Bits>(digits, len, decimal_exponent, value);
+
+    if (precision > 0) return format_rounded_digits(buf, digits, len, decimal_exponent, precision);
+
+    return format_digits(buf, digits, len, decimal_exponent, value);
+}
+#endif // FOJSON_HAVE_FP_TO_CHARS
+
+// "00" through "99", so that integers can be written two digits at a time
+const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// The number of decimal digits in n.
+unsigned int count_digits(uint32_t n)
+{
+#ifdef __GNUC__
+    // Estimate floor(log10(n)) from the bit length (1233/4096 ~ log10(2)),
+    // then correct it with a single compare.
+    static const uint32_t powers_of_10[] = { 0, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+        1000000000 };
+    const unsigned int t = ((32 - __builtin_clz(n | 1)) * 1233) >> 12;
+    return t + 1 - (n < powers_of_10[t]);
+#else
+    unsigned int digits = 1;
+    for (; n >= 10000; n /= 10000)
+        digits += 4;
+    return digits + (n >= 10) + (n >= 100) + (n >= 1000);
+#endif
+}
+
+char *format_unsigned(char *buf, uint32_t n)
+{
+    const unsigned int len = count_digits(n);
+    char *p = buf + len;
+
+    while (n >= 100) {
+        const unsigned int i = (n % 100) * 2;
+        n /= 100;
+        *--p = digit_pairs[i + 1];
+        *--p = digit_pairs[i];
+    }
+    if (n >= 10) {
+        *--p = digit_pairs[n * 2 + 1];
+        *--p = digit_pairs[n * 2];
+    }
+    else {
+        *--p = char('0' + n);
+    }
+
+    return buf + len;
+}
+
+char *format_signed(char *buf, int32_t n)
+{
+    if (n < 0) {
+        *buf++ = '-';
+        // Negate as unsigned so that INT32_MIN does not overflow
+        return format_unsigned(buf, 0u - uint32_t(n));
+    }
+    return format_unsigned(buf, uint32_t(n));
+}
+
+// Every Byte value pre-rendered with its leading separator: ", 0" through
+// ", 255". An entry is eight bytes, the text and its length, and is copied
+// whole with one fixed-size memcpy; the output then advances by only 'len',
+// so the next value overwrites the bytes copied after the text.
+struct byte_string {
+    char text[7];
+    unsigned char len;
+};
+
+// Fails to compile if an entry is not eight bytes
+typedef char byte_string_is_eight_bytes[sizeof(byte_string) == 8 ? 1 : -1];
+
+class byte_string_table {
+private:
+    byte_string d_strings[256];
+
+public:
+    byte_string_table()
+    {
+        for (unsigned int i = 0; i < 256; i++) {
+            memset(d_strings[i].text, 0, sizeof(d_strings[i].text));
+            d_strings[i].text[0] = ',';
+            d_strings[i].text[1] = ' ';
+            d_strings[i].len = format_unsigned(d_strings[i].text + 2, i) - d_strings[i].text;
+        }
+    }
+
+    const byte_string &operator[](libdap::dods_byte value) const
+    {
+        return d_strings[value];
+    }
+};
+
+const byte_string_table byte_strings;
+
+// The length of the separators between count values
+inline uint64_t separators_size(unsigned int count, bool compact)
+{
+    return count ? uint64_t(count - 1) * (compact ? 1 : 2) : 0;
+}
+
+// The length of count integers, counted from their digits
+template<typename T>
+uint64_t integer_values_size(const T *values, unsigned int count, bool compact)
+{
+    uint64_t size = separators_size(count, compact);
+    for (unsigned int i = 0; i < count; i++) {
+        if (values[i] < 0)
+            size += 1 + count_digits(0u - uint32_t(values[i]));
+        else
+            size += count_digits(uint32_t(values[i]));
+    }
+    return size;
+}
+
+// The length of count floating point values, measured by formatting each
+// one into a buffer on the stack as write_values() would
+template<typename T, typename Format>
+uint64_t measured_values_size(const T *values, unsigned int count, bool compact, const std::string &non_finite,
+    Format format)
+{
+    char buf[max_number_chars];
+    uint64_t size = separators_size(count, compact);
+    for (unsigned int i = 0; i < count; i++)
+        size += is_finite(values[i]) ? uint64_t(format(buf, values[i]) - buf) : non_finite.length();
+    return size;
+}
+
+template<typename T>
+uint64_t floating_point_values_size(const T *values, unsigned int count, bool compact, const ValueFormat &format)
+{
+    if (format.precision > 0)
+        return measured_values_size(values, count, compact, format.non_finite, rounded_format(format.precision));
+    return measured_values_size(values, count, compact, format.non_finite, shortest_format());
+}
+
+/*
+ * JSON has no representation for NaN or Inf. Float arrays are scanned
+ * first; when all the values are finite (the usual case) they are written
+ * without testing each one.
+ */
+template<typename T>
+void write_floating_point_values(JsonWriter *writer, const T *values, unsigned int count, const ValueFormat &format)
+{
+    if (format.precision > 0) {
+        if (all_finite(values, count))
+            write_number_values(writer, values, count, rounded_format(format.precision));
+        else
+            write_checked_values(writer, values, count, format.non_finite, rounded_format(format.precision));
+    }
+    else {
+        if (all_finite(values, count))
+            write_number_values(writer, values, count, shortest_format());
+        else
+            write_checked_values(writer, values, count, format.non_finite, shortest_format());
+    }
+}
+
+} // namespace
+
+/** @name is_finite
+ * Is the value neither NaN nor +/-Inf? The test is made on the exponent
+ * bits so it does not depend on the compiler's floating point options.
+ */
+///@{
+bool is_finite(libdap::dods_float32 value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x7f800000U) != 0x7f800000U;
+}
+
+bool is_finite(libdap::dods_float64 value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x7ff0000000000000ULL) != 0x7ff0000000000000ULL;
+}
+///@}
+
+/** @name all_finite
+ * Are all of the values finite? On x86 the values are tested several at a
+ * time with SSE2 instructions.
+ *
+ * @param values The first value to test
+ * @param count The number of values to test
+ */
+///@{
+bool all_finite(const libdap::dods_float32 *values, unsigned int count)
+{
+    return all_finite_values(values, count);
+}
+
+bool all_finite(const libdap::dods_float64 *values, unsigned int count)
+{
+    return all_finite_values(values, count);
+}
+///@}
+
+/** @name format_number
+ * Write an integer value in decimal, two digits at a time, straight into
+ * a character buffer.
+ *
+ * @param buf Write here; must have room for max_number_chars characters
+ * @param value The value
+ * @return A pointer to the character following the last one written
+ */
+///@{
+char *format_number(char *buf, libdap::dods_int16 value)
+{
+    return format_signed(buf, value);
+}
+
+char *format_number(char *buf, libdap::dods_uint16 value)
+{
+    return format_unsigned(buf, value);
+}
+
+char *format_number(char *buf, libdap::dods_int32 value)
+{
+    return format_signed(buf, value);
+}
+
+char *format_number(char *buf, libdap::dods_uint32 value)
+{
+    return format_unsigned(buf, value);
+}
+///@}
+
+/**
+ * Write the shortest decimal representation of a Float32 value that reads
+ * back (as a float) to the same bits. The value is not widened to double
+ * first, so 0.1f is written as 0.1 and not 0.100000001490116.
+ *
+ * @param buf Write here; must have room for max_number_chars characters
+ * @param value The value
+ * @return A pointer to the character following the last one written
+ */
+char *format_number(char *buf, libdap::dods_float32 value)
+{
+#ifdef FOJSON_HAVE_FP_TO_CHARS
+    return std::to_chars(buf, buf + max_number_chars, value).ptr;
+#else
+    return format_floating_point<libdap::dods_float32, uint32_t>(buf, value, 0);
+#endif
+}
+
+/**
+ * Write the shortest decimal representation of a Float64 value that reads
+ * back to the same bits.
+ *
+ * @param buf Write here; must have room for max_number_chars characters
+ * @param value The value
+ * @return A pointer to the character following the last one written
+ */
+char *format_number(char *buf, libdap::dods_float64 value)
+{
+#ifdef FOJSON_HAVE_FP_TO_CHARS
+    return std::to_chars(buf, buf + max_number_chars, value).ptr;
+#else
+    return format_floating_point<libdap::dods_float64, uint64_t>(buf, value, 0);
+#endif
+}
+
+/** @name format_number
+ * Write a Float32 or Float64 value rounded to a number of significant
+ * digits, using the same layout as printf()'s %.*g. The rounding is done on
+ * the shortest decimal representation of the value, so no more digits are
+ * written than format_number(buf, value) would write. Precisions larger
+ * than that can ever be (9 for Float32, 17 for Float64) are reduced.
+ *
+ * @param buf Write here; must have room for max_number_chars characters
+ * @param value The value
+ * @param precision The number of significant digits; 0 is the same as
+ * calling format_number(buf, value)
+ * @return A pointer to the character following the last one written
+ */
+///@{
+char *format_number(char *buf, libdap::dods_float32 value, int precision)
+{
+    if (precision <= 0) return format_number(buf, value);
+    if (precision > 9) precision = 9;
+#ifdef FOJSON_HAVE_FP_TO_CHARS
+    if (!is_finite(value)) return format_number(buf, value);
+    return format_rounded(buf, value, precision);
+#else
+    return format_floating_point<libdap::dods_float32, uint32_t>(buf, value, precision);
+#endif
+}
+
+char *format_number(char *buf, libdap::dods_float64 value, int precision)
+{
+    if (precision <= 0) return format_number(buf, value);
+    if (precision > 17) precision = 17;
+#ifdef FOJSON_HAVE_FP_TO_CHARS
+    if (!is_finite(value)) return format_number(buf, value);
+    return format_rounded(buf, value, precision);
+#else
+    return format_floating_point<libdap::dods_float64, uint64_t>(buf, value, precision);
+#endif
+}
+///@}
+
+/** @name write_values
+ * Write the values of the innermost dimension of an array as a comma
+ * separated list (without the enclosing brackets). A writer that is
+ * measuring a response (see JsonWriter::set_sizing()) is given the length
+ * of that text, from values_size(), instead.
+ *
+ * @param writer Write here
+ * @param values The first value to write
+ * @param count The number of values to write
+ * @param format For Float32 and Float64, the precision and the text
+ * written for NaN and Inf
+ */
+///@{
+void write_values(JsonWriter *writer, const libdap::dods_byte *values, unsigned int count, const ValueFormat &)
+{
+    if (writer->sizing()) {
+        writer->add_size(values_size(values, count, writer->compact(), ValueFormat()));
+        return;
+    }
+
+    // Byte arrays are written by copying pre-rendered strings.
+    if (count == 0) return;
+
+    const bool compact = writer->compact();
+
+    // The first value has no separator
+    const byte_string &first = byte_strings[values[0]];
+    writer->raw(first.text + 2, first.len - 2);
+
+    for (unsigned int i = 1; i < count; i++) {
+        const byte_string &b = byte_strings[values[i]];
+        char *p = writer->reserve(sizeof(byte_string));
+        if (compact) {
+            // The entry from its space on, with the comma written over the space
+            memcpy(p, b.text + 1, sizeof(byte_string) - 1);
+            *p = ',';
+            writer->commit(p + b.len - 1);
+        }
+        else {
+            memcpy(p, &b, sizeof(byte_string));
+            writer->commit(p + b.len);
+        }
+    }
+}
+
+void write_values(JsonWriter *writer, const libdap::dods_int16 *values, unsigned int count, const ValueFormat &)
+{
+    if (writer->sizing()) {
+        writer->add_size(values_size(values, count, writer->compact(), ValueFormat()));
+        return;
+    }
+
+    write_number_values(writer, values, count, shortest_format());
+}
+
+void write_values(JsonWriter *writer, const libdap::dods_uint16 *values, unsigned int count, const ValueFormat &)
+{
+    if (writer->sizing()) {
+        writer->add_size(values_size(values, count, writer->compact(), ValueFormat()));
+        return;
+    }
+
+    write_number_values(writer, values, count, shortest_format());
+}
+
+void write_values(JsonWriter *writer, const libdap::dods_int32 *values, unsigned int count, const ValueFormat &)
+{
+    if (writer->sizing()) {
+        writer->add_size(values_size(values, count, writer->compact(), ValueFormat()));
+        return;
+    }
+
+    write_number_values(writer, values, count, shortest_format());
+}
+
+void write_values(JsonWriter *writer, const libdap::dods_uint32 *values, unsigned int count, const ValueFormat &)
+{
+    if (writer->sizing()) {
+        writer->add_size(values_size(values, count, writer->compact(), ValueFormat()));
+        return;
+    }
+
+    write_number_values(writer, values, count, shortest_format());
+}
+
+void write_values(JsonWriter *writer, const libdap::dods_float32 *values, unsigned int count,
+    const ValueFormat &format)
+{
+    if (writer->sizing()) {
+        writer->add_size(values_size(values, count, writer->compact(), format));
+        return;
+    }
+
+    write_floating_point_values(writer, values, count, format);
+}
+
+void write_values(JsonWriter *writer, const libdap::dods_float64 *values, unsigned int count,
+    const ValueFormat &format)
+{
+    if (writer->sizing()) {
+        writer->add_size(values_size(values, count, writer->compact(), format));
+        return;
+    }
+
+    write_floating_point_values(writer, values, count, format);
+}
+
+void write_values(JsonWriter *writer, const std::string *values, unsigned int count, const ValueFormat &)
+{
+    if (writer->sizing()) {
+        writer->add_size(values_size(values, count, writer->compact(), ValueFormat()));
+        return;
+    }
+
+    // Strings need to be escaped to be included in a JSON object.
+    for (unsigned int i = 0; i < count; i++) {
+        if (i) writer->separator();
+        writer->quoted(values[i]);
+    }
+}
+///@}
+
+/** @name values_size
+ * The length of the text write_values() writes for the same values,
+ * computed without writing it: from the digits of integers, the
+ * pre-rendered length of Byte values, the escaped length of strings, and
+ * for Float32 and Float64 by formatting each value into a small buffer.
+ *
+ * @param values The first value
+ * @param count The number of values
+ * @param compact True if the separators have no space
+ * @param format For Float32 and Float64, the precision and the text
+ * written for NaN and Inf
+ */
+///@{
+uint64_t values_size(const libdap::dods_byte *values, unsigned int count, bool compact, const ValueFormat &)
+{
+    uint64_t size = separators_size(count, compact);
+    for (unsigned int i = 0; i < count; i++)
+        size += byte_strings[values[i]].len - 2;
+    return size;
+}
+
+uint64_t values_size(const libdap::dods_int16 *values, unsigned int count, bool compact, const ValueFormat &)
+{
+    return integer_values_size(values, count, compact);
+}
+
+uint64_t values_size(const libdap::dods_uint16 *values, unsigned int count, bool compact, const ValueFormat &)
+{
+    return integer_values_size(values, count, compact);
+}
+
+uint64_t values_size(const libdap::dods_int32 *values, unsigned int count, bool compact, const ValueFormat &)
+{
+    return integer_values_size(values, count, compact);
+}
+
+uint64_t values_size(const libdap::dods_uint32 *values, unsigned int count, bool compact, const ValueFormat &)
+{
+    return integer_values_size(values, count, compact);
+}
+
+uint64_t values_size(const libdap::dods_float32 *values, unsigned int count, bool compact, const ValueFormat &format)
+{
+    return floating_point_values_size(values, count, compact, format);
+}
+
+uint64_t values_size(const libdap::dods_float64 *values, unsigned int count, bool compact, const ValueFormat &format)
+{
+    return floating_point_values_size(values, count, compact, format);
+}
+
+uint64_t values_size(const std::string *values, unsigned int count, bool compact, const ValueFormat &)
+{
+    uint64_t size = separators_size(count, compact);
+    for (unsigned int i = 0; i < count; i++)
+        size += 2 + escaped_size(values[i]);
+    return size;
+}
+///@}
+
+/**
+ * Write the value of a scalar variable of one of the atomic DAP2 types.
+ *
+ * @param writer Write here
+ * @param bt The variable; Byte, Int16, UInt16, Int32, UInt32, Float32,
+ * Float64, Str or Url
+ * @param format For Float32 and Float64, the precision and the text
+ * written for NaN and Inf
+ */
+void write_value(JsonWriter *writer, libdap::BaseType *bt, const ValueFormat &format)
+{
+    switch (bt->type()) {
+    case libdap::dods_byte_c: {
+        libdap::dods_byte value = static_cast<libdap::Byte *>(bt)->value();
+        write_values(writer, &value, 1, format);
+        break;
+    }
+    case libdap::dods_int16_c:
+        writer->number(static_cast<libdap::Int16 *>(bt)->value());
+        break;
+    case libdap::dods_uint16_c:
+        writer->number(static_cast<libdap::UInt16 *>(bt)->value());
+        break;
+    case libdap::dods_int32_c:
+        writer->number(static_cast<libdap::Int32 *>(bt)->value());
+        break;
+    case libdap::dods_uint32_c:
+        writer->number(static_cast<libdap::UInt32 *>(bt)->value());
+        break;
+    case libdap::dods_float32_c: {
+        libdap::dods_float32 value = static_cast<libdap::Float32 *>(bt)->value();
+        write_values(writer, &value, 1, format);
+        break;
+    }
+    case libdap::dods_float64_c: {
+        libdap::dods_float64 value = static_cast<libdap::Float64 *>(bt)->value();
+        write_values(writer, &value, 1, format);
+        break;
+    }
+    case libdap::dods_str_c:
+    case libdap::dods_url_c:
+        writer->quoted(static_cast<libdap::Str *>(bt)->value());
+        break;
+    default:
+        throw BESInternalError("File out JSON, " + bt->type_name() + " is not an atomic type.", __FILE__, __LINE__);
+    }
+}
+
+} // namespace fojson
@@ -0,0 +1,118 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+//
+// fojson_format.h
+//
+// This file is part of BES JSON File Out Module
+//
+// Copyright (c) 2014 OPeNDAP, Inc.
+// Author: Nathan Potter <ndp@opendap.org>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+// (c) COPYRIGHT URI/MIT 1995-1999
+// Please read the full copyright statement in the file COPYRIGHT_URI.
+//
+
+
+#ifndef FOJSON_FORMAT_H_
+#define FOJSON_FORMAT_H_ 1
+
+#include <stdint.h>
+
+#include <ostream>
+#include <string>
+
+#include <dods-datatypes.h>
+
+namespace libdap {
+class BaseType;
+}
+
+namespace fojson {
+
+/// Largest number of characters written by any of the format_number() functions.
+const unsigned int max_number_chars = 32;
+
+/// Written in place of NaN and Inf, which JSON numbers cannot represent.
+const char * const default_non_finite = "null";
+
+bool is_finite(libdap::dods_float32 value);
+bool is_finite(libdap::dods_float64 value);
+bool all_finite(const libdap::dods_float32 *values, unsigned int count);
+bool all_finite(const libdap::dods_float64 *values, unsigned int count);
+
+char *format_number(char *buf, libdap::dods_int16 value);
+char *format_number(char *buf, libdap::dods_uint16 value);
+char *format_number(char *buf, libdap::dods_int32 value);
+char *format_number(char *buf, libdap::dods_uint32 value);
+char *format_number(char *buf, libdap::dods_float32 value);
+char *format_number(char *buf, libdap::dods_float64 value);
+char *format_number(char *buf, libdap::dods_float32 value, int precision);
+char *format_number(char *buf, libdap::dods_float64 value, int precision);
+
+class JsonWriter;
+
+/**
+ * How write_values() formats Float32 and Float64 values.
+ */
+struct ValueFormat {
+    /// Written in place of NaN and Inf values
+    std::string non_finite;
+    /// Significant digits; 0 for the shortest value that reads back exactly
+    int precision;
+
+    ValueFormat() : non_finite(default_non_finite), precision(0) { }
+};
+
+void write_values(JsonWriter *writer, const libdap::dods_byte *values, unsigned int count,
+    const ValueFormat &format = ValueFormat());
+void write_values(JsonWriter *writer, const libdap::dods_int16 *values, unsigned int count,
+    const ValueFormat &format = ValueFormat());
+void write_values(JsonWriter *writer, const libdap::dods_uint16 *values, unsigned int count,
+    const ValueFormat &format = ValueFormat());
+void write_values(JsonWriter *writer, const libdap::dods_int32 *values, unsigned int count,
+    const ValueFormat &format = ValueFormat());
+void write_values(JsonWriter *writer, const libdap::dods_uint32 *values, unsigned int count,
+    const ValueFormat &format = ValueFormat());
+void write_values(JsonWriter *writer, const libdap::dods_float32 *values, unsigned int count,
+    const ValueFormat &format = ValueFormat());
+void write_values(JsonWriter *writer, const libdap::dods_float64 *values, unsigned int count,
+    const ValueFormat &format = ValueFormat());
+void write_values(JsonWriter *writer, const std::string *values, unsigned int count,
+    const ValueFormat &format = ValueFormat());
+
+void write_value(JsonWriter *writer, libdap::BaseType *bt, const ValueFormat &format = ValueFormat());
+
+uint64_t values_size(const libdap::dods_byte *values, unsigned int count, bool compact,
+    const ValueFormat &format = ValueFormat());
+uint64_t values_size(const libdap::dods_int16 *values, unsigned int count, bool compact,
+    const ValueFormat &format = ValueFormat());
+uint64_t values_size(const libdap::dods_uint16 *values, unsigned int count, bool compact,
+    const ValueFormat &format = ValueFormat());
+uint64_t values_size(const libdap::dods_int32 *values, unsigned int count, bool compact,
+    const ValueFormat &format = ValueFormat());
+uint64_t values_size(const libdap::dods_uint32 *values, unsigned int count, bool compact,
+    const ValueFormat &format = ValueFormat());
+uint64_t values_size(const libdap::dods_float32 *values, unsigned int count, bool compact,
+    const ValueFormat &format = ValueFormat());
+uint64_t values_size(const libdap::dods_float64 *values, unsigned int count, bool compact,
+    const ValueFormat &format = ValueFormat());
+uint64_t values_size(const std::string *values, unsigned int count, bool compact,
+    const ValueFormat &format = ValueFormat());
+
+} // namespace fojson
+
+#endif /* FOJSON_FORMAT_H_ */
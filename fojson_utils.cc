@@ -26,28 +26,309 @@
 // Please read the full copyright statement in the file COPYRIGHT_URI.
 //
 
+#include "config.h"
+
 #include "fojson_utils.h"
+#include "JsonWriter.h"
 
 
 #include <BESDebug.h>
+#include <BESSyntaxUserError.h>
+#include <BESDataHandlerInterface.h>
+#include <BESDataNames.h>
+#include <BESContextManager.h>
+#include <BESDataDDSResponse.h>
+#include <BESDapResponseBuilder.h>
+#include <BESInternalError.h>
+#include <BESInternalFatalError.h>
+#include <BESLog.h>
+#include <TheBESKeys.h>
+
+#include <DDS.h>
+#include <Constructor.h>
+#include <ConstraintEvaluator.h>
+#include <Error.h>
 
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <climits>
 #include <sstream>
-#include <iomanip>
+#include <algorithm>
+#include <ostream>
+
+// The escape scanner uses SSE2, and AVX2 when the CPU has it.
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define FOJSON_SIMD_ESCAPE_SCAN 1
+#endif
 
 #define utils_debug_key "fojson"
 
+// returnAs names ending with this ask for compact output (json_min, ijson_min)
+#define FO_JSON_COMPACT_SUFFIX "_min"
+#define FO_JSON_COMPACT_CONTEXT "fojson_compact"
+
+#define FO_JSON_GZIP_SUFFIX "_gz"
+#define FO_JSON_COMPRESSION_CONTEXT "fojson_compression"
+
 namespace fojson {
 
-std::string escape_for_json(const std::string &input) {
-    std::stringstream ss;
-    for (size_t i = 0; i < input.length(); ++i) {
-        if (unsigned(input[i]) < '\x20' || input[i] == '\\' || input[i] == '"') {
-            ss << "\\u" << std::setfill('0') << std::setw(4) << std::hex << unsigned(input[i]);
-        } else {
-            ss << input[i];
+namespace {
+
+const char hex_digits[] = "0123456789abcdef";
+
+inline bool needs_escape(char c)
+{
+    return (unsigned char) c < 0x20 || c == '\\' || c == '"';
+}
+
+// Characters that need escaping are written as \u00XX
+inline void escape_char(char c, char *out)
+{
+    out[0] = '\\';
+    out[1] = 'u';
+    out[2] = '0';
+    out[3] = '0';
+    out[4] = hex_digits[((unsigned char) c) >> 4];
+    out[5] = hex_digits[((unsigned char) c) & 0xf];
+}
+
+const size_t escaped_char_len = 6;
+
+#ifdef FOJSON_SIMD_ESCAPE_SCAN
+/*
+ * A byte needs escaping if it is '"', '\' or is less than 0x20 when read as
+ * unsigned; min_epu8(v, 0x1f) == v is that last test.
+ */
+inline int escape_mask_sse2(__m128i v)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+
+    return _mm_movemask_epi8(m);
+}
+
+size_t find_escape_sse2(const char *s, size_t i, size_t n)
+{
+    for (; i + 16 <= n; i += 16) {
+        int mask = escape_mask_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i)));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t find_escape_avx2(const char *s, size_t i, size_t n)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1f);
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v));
+
+        unsigned int mask = _mm256_movemask_epi8(m);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i;
+}
+
+bool cpu_has_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+const bool have_avx2 = cpu_has_avx2();
+#endif
+
+/*
+ * Return the index of the first character in s[i, n) that needs escaping,
+ * or n if there is none. Scans 32 (AVX2) or 16 (SSE2) bytes at a time when
+ * the CPU supports it.
+ */
+size_t find_escape(const char *s, size_t i, size_t n)
+{
+#ifdef FOJSON_SIMD_ESCAPE_SCAN
+    if (have_avx2)
+        i = find_escape_avx2(s, i, n);
+    i = find_escape_sse2(s, i, n);
+    if (i + 16 <= n) return i;  // the SIMD scan stopped on a match
+#endif
+    for (; i < n; ++i) {
+        if (needs_escape(s[i])) return i;
+    }
+    return n;
+}
+
+} // namespace
+
+/**
+ * Return a copy of the input with the characters JSON does not allow in a
+ * string escaped. Use one of the other versions when the result is just
+ * going to be written somewhere.
+ */
+std::string escape_for_json(const std::string &input)
+{
+    if (find_escape(input.data(), 0, input.length()) == input.length()) return input;
+
+    std::string output;
+    escape_for_json(input, output);
+    return output;
+}
+
+/**
+ * Append the escaped input to the output string.
+ */
+void escape_for_json(const std::string &input, std::string &output)
+{
+    const char *s = input.data();
+    const size_t n = input.length();
+
+    size_t start = 0;
+    size_t i;
+    while ((i = find_escape(s, start, n)) < n) {
+        output.append(s + start, i - start);
+        char escaped[escaped_char_len];
+        escape_char(s[i], escaped);
+        output.append(escaped, escaped_char_len);
+        start = i + 1;
+    }
+    output.append(s + start, n - start);
+}
+
+/**
+ * Write the escaped input to the stream. Runs of characters that do not
+ * need escaping (usually the whole string) are written without a copy.
+ */
+void escape_for_json(std::ostream *strm, const std::string &input)
+{
+    const char *s = input.data();
+    const size_t n = input.length();
+
+    size_t start = 0;
+    size_t i;
+    while ((i = find_escape(s, start, n)) < n) {
+        strm->write(s + start, i - start);
+        char escaped[escaped_char_len];
+        escape_char(s[i], escaped);
+        strm->write(escaped, escaped_char_len);
+        start = i + 1;
+    }
+    strm->write(s + start, n - start);
+}
+
+/**
+ * Append the escaped input to the JsonWriter.
+ */
+void escape_for_json(JsonWriter *writer, const std::string &input)
+{
+    const char *s = input.data();
+    const size_t n = input.length();
+
+    size_t start = 0;
+    size_t i;
+    while ((i = find_escape(s, start, n)) < n) {
+        writer->raw(s + start, i - start);
+        char escaped[escaped_char_len];
+        escape_char(s[i], escaped);
+        writer->raw(escaped, escaped_char_len);
+        start = i + 1;
+    }
+    writer->raw(s + start, n - start);
+}
+
+/**
+ * The length of the escaped input, without escaping it.
+ */
+uint64_t escaped_size(const std::string &input)
+{
+    const char *s = input.data();
+    const size_t n = input.length();
+
+    uint64_t size = n;
+    size_t i = 0;
+    while ((i = find_escape(s, i, n)) < n) {
+        size += escaped_char_len - 1;
+        ++i;
+    }
+    return size;
+}
+
+/**
+ * Return the escaped input enclosed in double quotes, ready to be used as
+ * a JSON string value or property name.
+ */
+std::string quote_for_json(const std::string &input)
+{
+    std::string output;
+    output.reserve(input.length() + 2);
+    output += '"';
+    escape_for_json(input, output);
+    output += '"';
+    return output;
+}
+
+// Skip the digits at text[i]; return how many there were
+static size_t skip_digits(const std::string &text, size_t &i)
+{
+    size_t start = i;
+    while (i < text.length() && text[i] >= '0' && text[i] <= '9')
+        i++;
+    return i - start;
+}
+
+/**
+ * Is text a JSON null, number or string, as written? The text configured
+ * to stand in for NaN and Inf goes into responses as it is, so it is
+ * checked with this first.
+ */
+bool is_json_scalar(const std::string &text)
+{
+    if (text == "null") return true;
+
+    size_t n = text.length();
+    if (n >= 2 && text[0] == '"' && text[n - 1] == '"') {
+        for (size_t i = 1; i < n - 1; i++) {
+            unsigned char c = text[i];
+            if (c < 0x20 || c == '"') return false;
+            if (c != '\\') continue;
+
+            if (++i == n - 1) return false;
+            c = text[i];
+            if (c == 'u') {
+                for (int h = 0; h < 4; h++)
+                    if (++i == n - 1 || !isxdigit((unsigned char) text[i])) return false;
+            }
+            else if (!strchr("\"\\/bfnrt", c) || c == '\0') {
+                return false;
+            }
         }
+        return true;
     }
-    return ss.str();
+
+    // -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+    size_t i = 0;
+    if (i < n && text[i] == '-') i++;
+    if (i < n && text[i] == '0')
+        i++;
+    else if (!skip_digits(text, i))
+        return false;
+    if (i < n && text[i] == '.' && !skip_digits(text, ++i)) return false;
+    if (i < n && (text[i] == 'e' || text[i] == 'E')) {
+        i++;
+        if (i < n && (text[i] == '+' || text[i] == '-')) i++;
+        if (!skip_digits(text, i)) return false;
+    }
+    return i == n;
 }
 
 /**
@@ -58,7 +339,7 @@ std::string escape_for_json(const std::string &input) {
  * @param shape The shape of the Array, taking into account the constraint
  * @return The total number of elements in the constrained Array.
  */
-long computeConstrainedShape(libdap::Array *a, std::vector<unsigned int> *shape ){
+uint64_t computeConstrainedShape(libdap::Array *a, std::vector<unsigned int> *shape ){
     BESDEBUG(utils_debug_key, "fojson::computeConstrainedShape() - BEGIN. Array name: "<< a->name() << endl);
 
     libdap::Array::Dim_iter dIt;
@@ -68,7 +349,7 @@ long computeConstrainedShape(libdap::Array *a, std::vector<unsigned int> *shape
 
     unsigned int dimSize = 1;
     int dimNum = 0;
-    long totalSize = 1;
+    uint64_t totalSize = 1;
 
     BESDEBUG(utils_debug_key, "fojson::computeConstrainedShape() - Array has " << a->dimensions(true) << " dimensions."<< endl);
 
@@ -91,6 +372,593 @@ long computeConstrainedShape(libdap::Array *a, std::vector<unsigned int> *shape
     return totalSize;
 }
 
+// Is bt, or any variable it holds, a Sequence?
+static bool has_sequence(libdap::BaseType *bt)
+{
+    if (bt->type() == libdap::dods_sequence_c) return true;
+
+    if (bt->is_constructor_type()) {
+        libdap::Constructor *c = static_cast<libdap::Constructor *>(bt);
+        for (libdap::Constructor::Vars_iter i = c->var_begin(), e = c->var_end(); i != e; ++i)
+            if (has_sequence(*i)) return true;
+    }
+
+    return false;
+}
+
+/**
+ * Does the DDS hold a Sequence? A Sequence's values are read as they are
+ * written, so a response with one can only be written once.
+ */
+bool has_sequence(libdap::DDS *dds)
+{
+    for (libdap::DDS::Vars_iter i = dds->var_begin(), e = dds->var_end(); i != e; ++i)
+        if (has_sequence(*i)) return true;
+
+    return false;
+}
+
+/**
+ * Free the values read into the variables of a DDS once they are no longer
+ * needed. The DDS itself still belongs to the response object.
+ */
+void release_data(libdap::DDS *dds)
+{
+    for (libdap::DDS::Vars_iter i = dds->var_begin(), e = dds->var_end(); i != e; ++i)
+        (*i)->clear_local_data();
+}
+
+/**
+ * Apply the request's constraint to a DataDDS without reading any values, so
+ * that its variables can be read as the response is written (see
+ * read_variable()). This is BESDapResponseBuilder::intern_dap2_data()
+ * without the reading: the constraint is decoded and split by the builder,
+ * parsed, and the size of the response checked against the DDS's response
+ * limit in the same way.
+ *
+ * A constraint that calls server functions needs all of its arguments read
+ * before anything can be written; then null is returned and nothing is
+ * done; use intern_dap2_data(). Otherwise read the DDS with read_data(), or
+ * only its Sequences, whose rows are read while they are written, with
+ * read_sequences(); the constraint must not be parsed again.
+ *
+ * @param obj The BESDataDDSResponse
+ * @param dhi Holds the constraint
+ * @param eval Set to the evaluator that holds the parsed constraint
+ * @return The constrained DDS, or null
+ * @throws libdap::Error if the response is larger than the response limit
+ */
+libdap::DDS *constrain_dds(BESResponseObject *obj, BESDataHandlerInterface &dhi, libdap::ConstraintEvaluator **eval)
+{
+    dhi.first_container();
+
+    BESDataDDSResponse *bdds = dynamic_cast<BESDataDDSResponse *>(obj);
+    if (!bdds) throw BESInternalError("cast error", __FILE__, __LINE__);
+
+    libdap::DDS *dds = bdds->get_dds();
+
+    BESDapResponseBuilder builder;
+    builder.set_ce(dhi.data[POST_CONSTRAINT]);
+    builder.split_ce(bdds->get_ce());
+    if (!builder.get_btp_func_ce().empty()) {
+        BESDEBUG(utils_debug_key, "fojson::constrain_dds() - The constraint calls a function: "
+            << builder.get_btp_func_ce() << endl);
+        return 0;
+    }
+
+    *eval = &bdds->get_ce();
+    (*eval)->parse_constraint(builder.get_ce(), *dds);
+
+    if (dds->get_response_limit() != 0 && dds->get_request_size(true) > dds->get_response_limit()) {
+        std::ostringstream msg;
+        msg << "The Request for " << dds->get_request_size(true) / 1024
+            << "KB is too large; requests for this user are limited to " << dds->get_response_limit() / 1024 << "KB.";
+        throw libdap::Error(msg.str());
+    }
+
+    return dds;
+}
+
+/**
+ * Read the values of every variable the constraint applied by
+ * constrain_dds() selects, using the evaluator that already holds the
+ * parsed constraint. The two together do what intern_dap2_data() does for
+ * a constraint that calls no server functions, so a response admitted by
+ * admit_response() is read the same way as one that was not checked.
+ */
+void read_data(libdap::DDS *dds, libdap::ConstraintEvaluator &eval)
+{
+    dds->tag_nested_sequences();
+    for (libdap::DDS::Vars_iter i = dds->var_begin(), e = dds->var_end(); i != e; ++i)
+        if ((*i)->send_p()) (*i)->intern_data(eval, *dds);
+}
+
+/**
+ * A DDS with a Sequence cannot be read as it is written, so once its
+ * constraint is applied (see constrain_dds()) read all of it now.
+ */
+void read_sequences(libdap::DDS *dds, libdap::ConstraintEvaluator &eval)
+{
+    if (!has_sequence(dds)) return;
+
+    BESDEBUG(utils_debug_key, "fojson::read_sequences() - The DDS has a Sequence; reading it now" << endl);
+    read_data(dds, eval);
+}
+
+/**
+ * Read the values of bt, unless they have been read already, by reading the
+ * top level variable that holds it. What has been written so far is flushed
+ * first so the client has it while the variable is read.
+ */
+void read_variable(JsonWriter *writer, libdap::BaseType *bt, libdap::ConstraintEvaluator &eval, libdap::DDS &dds)
+{
+    if (bt->read_p()) return;
+
+    libdap::BaseType *top = bt;
+    while (top->get_parent()) top = top->get_parent();
+
+    BESDEBUG(utils_debug_key, "fojson::read_variable() - Reading " << top->name() << endl);
+
+    writer->flush();
+    top->intern_data(eval, dds);
+}
+
+/**
+ * The number of values in one row of the outermost dimension of an array
+ * with this (constrained) shape.
+ */
+uint64_t row_size(const std::vector<unsigned int> &shape)
+{
+    uint64_t size = 1;
+    for (std::vector<unsigned int>::size_type i = 1; i < shape.size(); i++)
+        size *= shape[i];
+
+    return size;
+}
+
+/**
+ * Should an Array be read in slabs and if so, how many rows of its outermost
+ * dimension should each slab hold?
+ *
+ * Only a top level Array that has not been read yet (its variables are read
+ * as they are written) and whose constrained values take more than
+ * slab_bytes is read in slabs. Each slab holds as many rows as fit in
+ * slab_bytes, and at least one.
+ *
+ * libdap counts the values of an Array with an int, so one whose constraint
+ * selects more values than that cannot be read whole. It is always read in
+ * slabs, each holding no more values than an int can count.
+ *
+ * @param a The Array
+ * @param shape Its constrained shape
+ * @param value_size The size of one value
+ * @param slab_bytes The most each slab should hold; 0 to only use slabs
+ * when the Array cannot be read whole
+ * @return The rows in a slab, or 0 if the Array should be read whole
+ */
+unsigned int slab_rows(libdap::Array *a, const std::vector<unsigned int> &shape, size_t value_size, size_t slab_bytes)
+{
+    if (shape.empty() || a->read_p() || a->get_parent()) return 0;
+
+    uint64_t row_values = row_size(shape);
+    if (row_values == 0 || value_size == 0) return 0;
+
+    uint64_t max_bytes = slab_bytes;
+    uint64_t max_values_bytes = (uint64_t) INT_MAX * value_size;
+    if (row_values * shape[0] > (uint64_t) INT_MAX && (max_bytes == 0 || max_bytes > max_values_bytes))
+        max_bytes = max_values_bytes;
+
+    uint64_t row_bytes = row_values * value_size;
+    if (max_bytes == 0 || row_bytes * shape[0] <= max_bytes) return 0;
+
+    uint64_t rows = max_bytes / row_bytes;
+    return rows ? rows : 1;
+}
+
+/**
+ * Read rows of an Array's outermost dimension into a new Array: a copy of a
+ * with that dimension further constrained to those rows. The caller must
+ * delete it.
+ *
+ * @param a The Array, constrained but not read
+ * @param first_row The first row to read, counting from the first
+ * row selected by a's constraint
+ * @param rows How many rows to read
+ */
+libdap::Array *read_slab(libdap::Array *a, unsigned int first_row, unsigned int rows)
+{
+    libdap::Array::Dim_iter d = a->dim_begin();
+    int start = a->dimension_start(d, true) + first_row * a->dimension_stride(d, true);
+    int stride = a->dimension_stride(d, true);
+
+    BESDEBUG(utils_debug_key, "fojson::read_slab() - " << a->name() << ", rows " << first_row << " to " << first_row + rows - 1 << endl);
+
+    libdap::Array *slab = static_cast<libdap::Array *>(a->ptr_duplicate());
+    try {
+        slab->add_constraint(slab->dim_begin(), start, stride, start + (rows - 1) * stride);
+        slab->read();
+    }
+    catch (...) {
+        delete slab;
+        throw;
+    }
+
+    return slab;
+}
+
+/**
+ * The bytes the projected values of bt take once read. A Sequence's rows
+ * are not known until it is read; it counts as one row.
+ */
+uint64_t variable_bytes(libdap::BaseType *bt)
+{
+    switch (bt->type()) {
+    case libdap::dods_array_c: {
+        libdap::Array *a = static_cast<libdap::Array *>(bt);
+        std::vector<unsigned int> shape(a->dimensions(true));
+        return computeConstrainedShape(a, &shape) * variable_bytes(a->var());
+    }
+
+    case libdap::dods_structure_c:
+    case libdap::dods_sequence_c:
+    case libdap::dods_grid_c: {
+        uint64_t bytes = 0;
+        libdap::Constructor *c = static_cast<libdap::Constructor *>(bt);
+        for (libdap::Constructor::Vars_iter i = c->var_begin(), e = c->var_end(); i != e; ++i)
+            if ((*i)->send_p()) bytes += variable_bytes(*i);
+        return bytes;
+    }
+
+    default:
+        return bt->width(true);
+    }
+}
+
+/**
+ * Estimate the most memory the values of a data response will take at once,
+ * from the constrained shapes of its projected variables and the widths of
+ * their values. Strings count as the size of a std::string and a Sequence as
+ * one row, so the estimate is low for those.
+ *
+ * Read whole, every variable is in memory at once. Read as it is written,
+ * only one top level variable is, and a large Array of numbers only one
+ * slab of it (see slab_rows()); but a DDS with a Sequence is read whole
+ * either way.
+ *
+ * Variables read whole are written on several threads when there are more
+ * than one; then the text of up to two variables per thread, each with no
+ * more than max_task_bytes of values, is held as well.
+ *
+ * @param dds The constrained DDS; its values need not be read
+ * @param read_as_written True if the variables are read as they are written
+ * @param slab_bytes The slab size used when they are
+ * @param threads The number of threads the variables are written on
+ * @return The estimate, in bytes
+ */
+uint64_t estimate_memory(libdap::DDS *dds, bool read_as_written, size_t slab_bytes, unsigned int threads)
+{
+    bool has_sequences = has_sequence(dds);
+    bool one_at_a_time = read_as_written && !has_sequences;
+    bool parallel = !read_as_written && !has_sequences && threads > 1;
+    uint64_t total = 0;
+    uint64_t largest = 0;
+    uint64_t task_text = 0;
+
+    for (libdap::DDS::Vars_iter i = dds->var_begin(), e = dds->var_end(); i != e; ++i) {
+        if (!(*i)->send_p()) continue;
+
+        uint64_t bytes = variable_bytes(*i);
+        if (one_at_a_time && (*i)->type() == libdap::dods_array_c) {
+            libdap::Array *a = static_cast<libdap::Array *>(*i);
+            libdap::Type t = a->var()->type();
+            if (a->var()->is_simple_type() && t != libdap::dods_str_c && t != libdap::dods_url_c) {
+                std::vector<unsigned int> shape(a->dimensions(true));
+                computeConstrainedShape(a, &shape);
+                unsigned int rows = slab_rows(a, shape, a->var()->width(true), slab_bytes);
+                if (rows) bytes = rows * row_size(shape) * a->var()->width(true);
+            }
+        }
+
+        total += bytes;
+        largest = std::max(largest, bytes);
+        if (parallel && bytes <= max_task_bytes) task_text += bytes * text_bytes_per_value_byte;
+    }
+
+    if (one_at_a_time) return largest;
+
+    uint64_t most_task_text = (2 * (uint64_t) threads + 1) * max_task_bytes * text_bytes_per_value_byte;
+    return total + std::min(task_text, most_task_text);
+}
+
+/**
+ * Admission control: decide whether a data response fits in max_bytes of
+ * memory before any of it is read (see estimate_memory()). When it does not
+ * fit read whole but does when each variable is read as it is written, and
+ * large Arrays in slabs no larger than max_bytes, read_as_written and
+ * slab_bytes are changed to do that. Otherwise it is refused. The decision
+ * and the estimate are logged.
+ *
+ * @param dds The constrained DDS, not read yet, or null if the constraint
+ * calls server functions (see constrain_dds()); such a response cannot be
+ * estimated before it is read, so it is admitted and that is logged
+ * @param max_bytes The most memory one response may use
+ * @param threads The number of threads the variables are written on
+ * @param read_as_written In: how the variables will be read. Out: set to
+ * true if they must be read as they are written to fit.
+ * @param slab_bytes In: the slab size. Out: the slab size to use.
+ * @throws BESSyntaxUserError if the response cannot fit
+ */
+void admit_response(libdap::DDS *dds, uint64_t max_bytes, unsigned int threads, bool &read_as_written,
+    unsigned long &slab_bytes)
+{
+    if (!dds) {
+        BESDEBUG(utils_debug_key, "fojson::admit_response() - The constraint calls a function; not estimated" << endl);
+        *(BESLog::TheLog()) << "FoJson: a response whose constraint calls server functions is not checked against"
+            " FoJson.MaxMemoryBytes (" << max_bytes << "); admitted" << endl;
+        return;
+    }
+
+    uint64_t estimate = estimate_memory(dds, read_as_written, slab_bytes, threads);
+    if (estimate <= max_bytes) {
+        BESDEBUG(utils_debug_key, "fojson::admit_response() - Estimated " << estimate << " bytes; admitted" << endl);
+        if (BESLog::TheLog()->is_verbose())
+            *(BESLog::TheLog()) << "FoJson: " << dds->get_dataset_name() << " response estimated at " << estimate
+                << " bytes, within FoJson.MaxMemoryBytes (" << max_bytes << "); admitted" << endl;
+        return;
+    }
+
+    unsigned long streaming_slab_bytes = (slab_bytes && slab_bytes <= max_bytes) ? slab_bytes : max_bytes;
+    uint64_t streaming = estimate_memory(dds, true, streaming_slab_bytes, threads);
+    if (streaming <= max_bytes) {
+        *(BESLog::TheLog()) << "FoJson: " << dds->get_dataset_name() << " response estimated at " << estimate
+            << " bytes, more than FoJson.MaxMemoryBytes (" << max_bytes << "); reading it as it is written ("
+            << streaming << " bytes)" << endl;
+        read_as_written = true;
+        slab_bytes = streaming_slab_bytes;
+        return;
+    }
+
+    *(BESLog::TheLog()) << "FoJson: " << dds->get_dataset_name() << " response estimated at " << estimate
+        << " bytes, more than FoJson.MaxMemoryBytes (" << max_bytes << "); refused" << endl;
+
+    std::ostringstream msg;
+    msg << "File out JSON, this request needs about " << estimate << " bytes of memory, more than the "
+        << max_bytes << " this server allows for one response. Please request less data.";
+    throw BESSyntaxUserError(msg.str(), __FILE__, __LINE__);
+}
+
+// Does s end with, and is longer than, suffix?
+static bool ends_with(const std::string &s, const std::string &suffix)
+{
+    return s.length() > suffix.length() && s.compare(s.length() - suffix.length(), suffix.length(), suffix) == 0;
+}
+
+/**
+ * Should the response be written without whitespace? It should when the
+ * returnAs name has the _min suffix or the fojson_compact context is true.
+ */
+bool compact_response(BESDataHandlerInterface &dhi)
+{
+    if (ends_with(dhi.data[RETURN_CMD], FO_JSON_COMPACT_SUFFIX)) return true;
+
+    bool found = false;
+    std::string context = BESContextManager::TheManager()->get_context(FO_JSON_COMPACT_CONTEXT, found);
+
+    return found && context == "true";
+}
+
+/**
+ * Get the Compression named by one of "none", "deflate", "gzip" or "zstd".
+ *
+ * @throws BESSyntaxUserError if the name is not one of those, or is zstd
+ * and the module was built without it
+ */
+Compression parse_compression(const std::string &name)
+{
+    if (name == "none")
+        return no_compression;
+    else if (name == "deflate")
+        return deflate_compression;
+    else if (name == "gzip")
+        return gzip_compression;
+#ifdef HAVE_ZSTD
+    else if (name == "zstd")
+        return zstd_compression;
+#else
+    else if (name == "zstd")
+        throw BESSyntaxUserError("File out JSON, this server was built without zstd compression.", __FILE__, __LINE__);
+#endif
+    else
+        throw BESSyntaxUserError("File out JSON, unknown compression '" + name + "'; use none, deflate, gzip or zstd.",
+            __FILE__, __LINE__);
+}
+
+/**
+ * How should the response be compressed? With gzip when the returnAs name
+ * has the _gz suffix; otherwise as the fojson_compression context says or,
+ * when that is not set, as configured.
+ *
+ * The BES has no way to set the HTTP Content-Encoding of a response, so a
+ * compressed response reaches the client as an opaque compressed file
+ * that it must decompress itself.
+ */
+Compression response_compression(BESDataHandlerInterface &dhi, Compression configured)
+{
+    if (ends_with(dhi.data[RETURN_CMD], FO_JSON_GZIP_SUFFIX)) return gzip_compression;
+
+    bool found = false;
+    std::string context = BESContextManager::TheManager()->get_context(FO_JSON_COMPRESSION_CONTEXT, found);
+    if (found && !context.empty()) return parse_compression(context);
+
+    return configured;
+}
+
+/**
+ * Add the entries in 'spec' to this PrecisionSpec. Entries replace ones
+ * already set, so a request's precision can be parsed over the server's.
+ *
+ * @param spec The precision, e.g. "4" or "4,time:0,sst:3"
+ * @throws BESSyntaxUserError if an entry is not a number or name:number
+ */
+void PrecisionSpec::parse(const std::string &spec)
+{
+    std::string::size_type start = 0;
+    while (start <= spec.length()) {
+        std::string::size_type end = spec.find(',', start);
+        if (end == std::string::npos) end = spec.length();
+
+        std::string entry = spec.substr(start, end - start);
+        start = end + 1;
+
+        std::string::size_type first = entry.find_first_not_of(" \t");
+        if (first == std::string::npos) continue;   // empty entry
+        entry = entry.substr(first, entry.find_last_not_of(" \t") - first + 1);
+
+        std::string name;
+        std::string digits = entry;
+        std::string::size_type colon = entry.rfind(':');
+        if (colon != std::string::npos) {
+            name = entry.substr(0, colon);
+            digits = entry.substr(colon + 1);
+        }
+
+        char *digits_end;
+        long precision = strtol(digits.c_str(), &digits_end, 10);
+        if (digits.empty() || *digits_end != '\0' || precision < 0 || precision > 99)
+            throw BESSyntaxUserError("File out JSON, bad precision '" + entry + "'; expected N or name:N",
+                __FILE__, __LINE__);
+
+        if (colon == std::string::npos)
+            _default_precision = precision;
+        else
+            _precisions[name] = precision;
+    }
+}
+
+/**
+ * The precision for a variable, matched first by its fully qualified name,
+ * then by its name, then the default.
+ */
+int PrecisionSpec::get_precision(libdap::BaseType *bt) const
+{
+    if (!_precisions.empty()) {
+        std::map<std::string, int>::const_iterator i = _precisions.find(bt->FQN());
+        if (i == _precisions.end()) i = _precisions.find(bt->name());
+        if (i != _precisions.end()) return i->second;
+    }
+
+    return _default_precision;
+}
+
+#define FO_JSON_TEMP_DIR "/tmp"
+#define FO_JSON_NON_FINITE_AS "null"
+#define FO_JSON_COMPRESSION_LEVEL 6
+
+Config *Config::d_instance = 0;
+
+/// The settings used when the configuration does not set them
+Config::Config() :
+    temp_dir(FO_JSON_TEMP_DIR), non_finite_as(FO_JSON_NON_FINITE_AS), compression(no_compression),
+    compression_level(FO_JSON_COMPRESSION_LEVEL), compression_threads(1), spill_to_disk(false),
+    read_as_written(false), slab_bytes(0), max_memory_bytes(0), serialize_threads(1), compute_size(false)
+{
+}
+
+/**
+ * The configuration, read the first time this is called.
+ * @throws BESInternalError or BESInternalFatalError if a key has a value
+ * that cannot be used
+ */
+const Config *Config::TheConfig()
+{
+    if (!d_instance) {
+        Config *config = new Config;
+        try {
+            config->read();
+        }
+        catch (...) {
+            delete config;
+            throw;
+        }
+        d_instance = config;
+    }
+    return d_instance;
+}
+
+/// Forget the configuration so that it is read again
+void Config::delete_instance()
+{
+    delete d_instance;
+    d_instance = 0;
+}
+
+// Get the value of a BES key; false if it is not set or is empty
+static bool key_value(const std::string &key, std::string &value)
+{
+    bool found = false;
+    TheBESKeys::TheKeys()->get_value(key, value, found);
+    return found && !value.empty();
+}
+
+// Set flag from a key that is true or yes, or anything else for false
+static void read_flag(const std::string &key, bool &flag)
+{
+    std::string value;
+    if (key_value(key, value)) flag = (value == "true" || value == "yes");
+}
+
+// Get a whole number from min to max from a key; expected says what it
+// must be when it is not
+static bool read_number(const std::string &key, unsigned long min, unsigned long max, const std::string &expected,
+    unsigned long &number)
+{
+    std::string value;
+    if (!key_value(key, value)) return false;
+
+    char *end;
+    errno = 0;
+    unsigned long n = strtoul(value.c_str(), &end, 10);
+    if (*end != '\0' || value[0] == '-' || errno == ERANGE || n < min || n > max)
+        throw BESInternalError("File out JSON, " + key + " must be " + expected + ".", __FILE__, __LINE__);
+
+    number = n;
+    return true;
+}
+
+// Read the settings from the BES keys
+void Config::read()
+{
+    if (key_value("FoJson.Tempdir", temp_dir) && temp_dir[temp_dir.length() - 1] == '/')
+        temp_dir.erase(temp_dir.length() - 1);
+    if (temp_dir.empty()) temp_dir = FO_JSON_TEMP_DIR;
+
+    if (!key_value("FoJson.NonFiniteAs", non_finite_as)) non_finite_as = FO_JSON_NON_FINITE_AS;
+    if (!is_json_scalar(non_finite_as))
+        throw BESInternalFatalError("File out JSON, FoJson.NonFiniteAs must be null, a JSON number or a quoted"
+            " JSON string.", __FILE__, __LINE__);
+
+    std::string value;
+    bool found = false;
+    TheBESKeys::TheKeys()->get_value("FoJson.Precision", value, found);
+    if (found) precision_spec.parse(value);
+
+    if (key_value("FoJson.Compression", value)) compression = parse_compression(value);
+
+    unsigned long number;
+    if (read_number("FoJson.CompressionLevel", 0, 9, "a number from 0 to 9", number)) compression_level = number;
+    if (read_number("FoJson.CompressionThreads", 1, 256, "a number from 1 to 256", number))
+        compression_threads = number;
+
+    read_flag("FoJson.SpillToDisk", spill_to_disk);
+    read_flag("FoJson.ReadAsWritten", read_as_written);
+
+    read_number("FoJson.SlabBytes", 0, ULONG_MAX, "a number of bytes", slab_bytes);
+    read_number("FoJson.MaxMemoryBytes", 0, ULONG_MAX, "a number of bytes", max_memory_bytes);
+    if (read_number("FoJson.SerializeThreads", 1, 256, "a number from 1 to 256", number)) serialize_threads = number;
+
+    read_flag("FoJson.ComputeSize", compute_size);
+}
+
 #if 0
 /**
  * Replace every occurrence of 'char_to_escape' with the same preceded
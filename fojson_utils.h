@@ -29,16 +29,134 @@
 #ifndef FOJSON_UTILS_H_
 #define FOJSON_UTILS_H_ 1
 
+#include <stdint.h>
+
+#include <ostream>
 #include <string>
 #include <vector>
+#include <map>
 
 #include <Array.h>
 
+class BESDataHandlerInterface;
+class BESResponseObject;
+
+namespace libdap {
+class DDS;
+class ConstraintEvaluator;
+}
+
 namespace fojson {
 
+class JsonWriter;
+
 std::string escape_for_json(const std::string &source);
+void escape_for_json(const std::string &source, std::string &dest);
+void escape_for_json(std::ostream *strm, const std::string &source);
+void escape_for_json(JsonWriter *writer, const std::string &source);
+std::string quote_for_json(const std::string &source);
+uint64_t escaped_size(const std::string &source);
+bool is_json_scalar(const std::string &text);
+
+uint64_t computeConstrainedShape(libdap::Array *a, std::vector<unsigned int> *shape );
+
+bool has_sequence(libdap::DDS *dds);
+void release_data(libdap::DDS *dds);
+
+libdap::DDS *constrain_dds(BESResponseObject *obj, BESDataHandlerInterface &dhi, libdap::ConstraintEvaluator **eval);
+void read_data(libdap::DDS *dds, libdap::ConstraintEvaluator &eval);
+void read_sequences(libdap::DDS *dds, libdap::ConstraintEvaluator &eval);
+void read_variable(JsonWriter *writer, libdap::BaseType *bt, libdap::ConstraintEvaluator &eval, libdap::DDS &dds);
+
+uint64_t row_size(const std::vector<unsigned int> &shape);
+unsigned int slab_rows(libdap::Array *a, const std::vector<unsigned int> &shape, size_t value_size, size_t slab_bytes);
+libdap::Array *read_slab(libdap::Array *a, unsigned int first_row, unsigned int rows);
+
+/// Top level variables with no more values than this, in bytes, are written
+/// on the serialization threads; larger ones are written in turn, so the
+/// text those threads hold is bounded
+const uint64_t max_task_bytes = 1024 * 1024;
+
+/// The text written for a number takes no more than about this many times
+/// the bytes of its value
+const unsigned int text_bytes_per_value_byte = 4;
+
+uint64_t variable_bytes(libdap::BaseType *bt);
+uint64_t estimate_memory(libdap::DDS *dds, bool read_as_written, size_t slab_bytes, unsigned int threads);
+void admit_response(libdap::DDS *dds, uint64_t max_bytes, unsigned int threads, bool &read_as_written,
+    unsigned long &slab_bytes);
+
+bool compact_response(BESDataHandlerInterface &dhi);
+
+/// The dhi.data entry that holds the size of an uncompressed response when
+/// FoJson.ComputeSize has it computed before the response is sent
+#define FO_JSON_RESPONSE_SIZE "fojson_response_size"
+
+/// How a response is compressed
+enum Compression {
+    no_compression,
+    deflate_compression,    ///< zlib format (HTTP's 'deflate')
+    gzip_compression,
+    zstd_compression        ///< Metadata responses use the module's dictionary
+};
+
+Compression parse_compression(const std::string &name);
+Compression response_compression(BESDataHandlerInterface &dhi, Compression configured);
+
+/**
+ * The number of significant digits to write for Float32 and Float64
+ * values: a default and, optionally, values for individual variables.
+ * A precision of 0 means the shortest representation that reads back to
+ * the same value.
+ *
+ * The text form is a comma separated list of entries. An entry is either a
+ * number, the default, or name:number, the precision for the variable with
+ * that name (or fully qualified name). "4,time:0,sst:3" writes four
+ * significant digits except for 'time' (full precision) and 'sst' (three).
+ */
+class PrecisionSpec {
+private:
+    int _default_precision;
+    std::map<std::string, int> _precisions;
+
+public:
+    PrecisionSpec() : _default_precision(0) { }
+
+    void parse(const std::string &spec);
+
+    int get_precision(libdap::BaseType *bt) const;
+};
+
+/**
+ * The module's settings from the BES configuration; fojson.conf.in
+ * describes each key. Both transmitters use the one instance, which is
+ * read and checked when it is first asked for.
+ */
+class Config {
+private:
+    static Config *d_instance;
+
+    void read();
+
+public:
+    std::string temp_dir;
+    std::string non_finite_as;
+    PrecisionSpec precision_spec;
+    Compression compression;
+    int compression_level;
+    unsigned int compression_threads;
+    bool spill_to_disk;
+    bool read_as_written;
+    unsigned long slab_bytes;
+    unsigned long max_memory_bytes;
+    unsigned int serialize_threads;
+    bool compute_size;
+
+    Config();
 
-long computeConstrainedShape(libdap::Array *a, std::vector<unsigned int> *shape );
+    static const Config *TheConfig();
+    static void delete_instance();
+};
 
 #if 0
 std::string backslash_escape(std::string source, char char_to_escape);
@@ -24,10 +24,19 @@
 
 //#include <cstdio>
 
+#include "config.h"
+
 #include <cppunit/TextTestRunner.h>
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/extensions/HelperMacros.h>
+#include <algorithm>
+#include <climits>
 #include <math.h>       /* atan */
+#include <stdlib.h>     /* strtod */
+
+#ifdef __GLIBCXX__
+#include <ext/stdio_sync_filebuf.h>
+#endif
 
 #include <GetOpt.h>
 #include <DataDDS.h>
@@ -43,26 +52,130 @@
 #include <Structure.h>
 #include <Sequence.h>
 #include <Grid.h>
+#include <ConstraintEvaluator.h>
+#include <Error.h>
 
 #include <debug.h>
 #include <util.h>
 
 #include <BESInternalError.h>
+#include <BESSyntaxUserError.h>
+#include <BESDataDDSResponse.h>
+#include <BESDataHandlerInterface.h>
+#include <BESDataNames.h>
 #include <BESDebug.h>
 
 #include "test_config.h"
 #include "fojson_utils.h"
+#include "fojson_format.h"
+#include "JsonWriter.h"
+#include "DeflateStream.h"
+#include "ParallelDeflateStream.h"
+#include "SpillFile.h"
+#include "StreamFailed.h"
+#include "TaskQueue.h"
+#ifdef HAVE_ZSTD
+#include "ZstdStream.h"
+#endif
 
 #include "FoInstanceJsonTransform.h"
 #include "FoDapJsonTransform.h"
 
 static bool debug = false;
+static bool large = false;
 
 #undef DBG
 #define DBG(x) do { if (debug) (x); } while(false);
 
 namespace fojson {
 
+// An Array whose values are read on demand. It records how much of the
+// response had been written when it was read.
+class OnDemandArray: public libdap::Array {
+public:
+    ostringstream *d_output;
+    string::size_type d_written_when_read;
+
+    OnDemandArray(const string &name, libdap::BaseType *proto, ostringstream *output) :
+        libdap::Array(name, proto), d_output(output), d_written_when_read(0)
+    {
+    }
+
+    virtual libdap::BaseType *ptr_duplicate() { return new OnDemandArray(*this); }
+
+    virtual bool read()
+    {
+        d_written_when_read = d_output->str().length();
+        libdap::dods_int32 values[] = { 1, 2, 3, 4 };
+        set_value(values, 4);
+        return true;
+    }
+};
+
+// A one-dimensional Array whose values are their indexes. It reads the
+// values selected by its constraint and records the most it has held.
+class SlabArray: public libdap::Array {
+public:
+    unsigned int *d_most_read;
+
+    SlabArray(const string &name, libdap::BaseType *proto, unsigned int *most_read) :
+        libdap::Array(name, proto), d_most_read(most_read)
+    {
+    }
+
+    virtual libdap::BaseType *ptr_duplicate() { return new SlabArray(*this); }
+
+    virtual bool read()
+    {
+        Dim_iter d = dim_begin();
+        vector<libdap::dods_int32> values;
+        for (int i = dimension_start(d, true); i <= dimension_stop(d, true); i += dimension_stride(d, true))
+            values.push_back(i);
+        set_value(&values[0], values.size());
+        *d_most_read = std::max(*d_most_read, (unsigned int) values.size());
+        return true;
+    }
+};
+
+// An Array of zeros that is never held whole: each read() sets only the
+// values its constraint selects and adds how many that was to a total.
+// With it the tests can write Arrays larger than memory.
+class ZeroArray: public libdap::Array {
+public:
+    uint64_t *d_values_read;
+
+    ZeroArray(const string &name, libdap::BaseType *proto, uint64_t *values_read) :
+        libdap::Array(name, proto), d_values_read(values_read)
+    {
+    }
+
+    virtual libdap::BaseType *ptr_duplicate() { return new ZeroArray(*this); }
+
+    virtual bool read()
+    {
+        vector<unsigned int> shape(dimensions(true));
+        uint64_t length = computeConstrainedShape(this, &shape);
+        vector<libdap::dods_byte> values(length, 0);
+        set_value(length ? &values[0] : 0, values.size());
+        *d_values_read += length;
+        return true;
+    }
+};
+
+// A task that records the order it was given in, and fails if asked to
+class OrderTask: public TaskQueue::Task {
+public:
+    int d_number;
+    bool d_fail;
+
+    OrderTask(int number, bool fail = false) : d_number(number), d_fail(fail) { }
+
+    virtual void run(unsigned int)
+    {
+        if (d_fail) throw BESSyntaxUserError("task failed", __FILE__, __LINE__);
+    }
+};
+
 class FoJsonTest: public CppUnit::TestFixture {
 
 private:
@@ -87,9 +200,9 @@ private:
         // read data as a block:
         is.read(&buffer[0], length);
         is.close();
-        buffer[length] = '\0';
 
-        return string(&buffer[0]);
+        // Binary files, like the zstd dictionary, hold NUL bytes
+        return string(&buffer[0], length);
     }
 
 public:
@@ -122,6 +235,32 @@ public:
     CPPUNIT_TEST(test_abstract_object_data_representation);
     CPPUNIT_TEST(test_instance_object_metadata_representation);
     CPPUNIT_TEST(test_instance_object_data_representation);
+    CPPUNIT_TEST(test_instance_object_compact_data_representation);
+    CPPUNIT_TEST(test_failed_stream);
+    CPPUNIT_TEST(test_read_as_written);
+    CPPUNIT_TEST(test_read_in_slabs);
+    CPPUNIT_TEST(test_release_data);
+    CPPUNIT_TEST(test_admit_response);
+    CPPUNIT_TEST(test_constrain_dds);
+    CPPUNIT_TEST(test_parallel_serialization);
+    CPPUNIT_TEST(test_large_shape);
+    CPPUNIT_TEST(test_large_array);
+    CPPUNIT_TEST(test_response_size);
+    CPPUNIT_TEST(test_is_json_scalar);
+    CPPUNIT_TEST(test_format_number_round_trip);
+    CPPUNIT_TEST(test_format_number_integers);
+    CPPUNIT_TEST(test_write_values_bytes);
+    CPPUNIT_TEST(test_escape_for_json);
+    CPPUNIT_TEST(test_write_values_non_finite);
+    CPPUNIT_TEST(test_format_number_precision);
+    CPPUNIT_TEST(test_precision_spec);
+    CPPUNIT_TEST(test_json_writer);
+    CPPUNIT_TEST(test_deflate_stream);
+    CPPUNIT_TEST(test_parallel_deflate_stream);
+    CPPUNIT_TEST(test_spill_file);
+#ifdef HAVE_ZSTD
+    CPPUNIT_TEST(test_zstd_stream);
+#endif
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -390,6 +529,966 @@ public:
 
     }
 
+    void test_instance_object_compact_data_representation()
+    {
+        try {
+            libdap::DataDDS *test_DDS = makeTestDDS();
+
+            string tmpFile(d_tmpDir + "/test_instance_object_representation_DATA_compact.json");
+            DBG(cerr << "FoJsonTest::test_instance_object_compact_data_representation() - tmpFile: " << tmpFile << endl);
+
+            FoInstanceJsonTransform ft(test_DDS);
+            ft.set_compact(true);
+
+            fstream output;
+            output.open(tmpFile.c_str(), std::fstream::out);
+            ft.transform(output, true);
+            output.close();
+
+            // Same as instance_object_test_DATA.json.baseline without the whitespace
+            string baseline = fileToString(
+                (string) TEST_SRC_DIR + "/baselines/instance_object_test_DATA_compact.json.baseline");
+            string result = fileToString(tmpFile);
+
+            DBG(cerr << "FoJsonTest::test_instance_object_compact_data_representation() - result: " << endl << result << endl);
+
+            CPPUNIT_ASSERT(baseline.compare(result) == 0);
+
+            delete test_DDS;
+        }
+        catch (BESInternalError &e) {
+            cerr << "BESInternalError: " << e.get_message() << endl;
+            CPPUNIT_ASSERT(false);
+        }
+        catch (libdap::Error &e) {
+            cerr << "Error: " << e.get_error_message() << endl;
+            CPPUNIT_ASSERT(false);
+        }
+    }
+
+    // A response written to a stream that has failed, as it does when the
+    // client disconnects, stops with StreamFailed rather than a BES error
+    void test_failed_stream()
+    {
+        libdap::DataDDS *test_DDS = makeTestDDS();
+
+        ostream failed(0);     // No streambuf; every write fails
+        FoDapJsonTransform ft(test_DDS);
+        try {
+            ft.transform(failed, true);
+            CPPUNIT_FAIL("Wrote a response to a failed stream");
+        }
+        catch (StreamFailed &e) {
+            DBG(cerr << e.what() << endl);
+        }
+
+        ostringstream output;
+        JsonWriter writer(output);
+        writer.raw("[1");
+        writer.checkpoint();
+        output.setstate(ios::badbit);
+        CPPUNIT_ASSERT_THROW(writer.checkpoint(), StreamFailed);
+
+        // Compressed responses stop the same way
+        ostream failed_too(0);
+        DeflateStream z_strm(failed_too, gzip_compression, 6);
+        FoDapJsonTransform z_ft(test_DDS);
+        CPPUNIT_ASSERT_THROW(z_ft.transform(z_strm, true), StreamFailed);
+
+        delete test_DDS;
+    }
+
+    // Variables read as they are written: what comes before each one has
+    // been sent when it is read, each is freed once written, and the
+    // response is the same
+    void test_read_as_written()
+    {
+        ostringstream output;
+        libdap::DataDDS dds(0, "on_demand");
+        libdap::Int32 proto("proto");
+        for (int i = 0; i < 2; i++) {
+            OnDemandArray a(i == 0 ? "first" : "second", &proto, &output);
+            a.append_dim(4, "x");
+            dds.add_var(&a);
+        }
+        for (libdap::DDS::Vars_iter i = dds.var_begin(); i != dds.var_end(); ++i)
+            (*i)->set_send_p(true);
+
+        libdap::ConstraintEvaluator eval;
+        FoDapJsonTransform ft(&dds);
+        ft.set_read_as_written(&eval);
+        ft.transform(output, true);
+        string streamed = output.str();
+        DBG(cerr << "test_read_as_written() - " << endl << streamed << endl);
+
+        OnDemandArray *first = static_cast<OnDemandArray *>(*dds.var_begin());
+        OnDemandArray *second = static_cast<OnDemandArray *>(*(dds.var_begin() + 1));
+        CPPUNIT_ASSERT(first->d_written_when_read > 0);
+        CPPUNIT_ASSERT(streamed.substr(0, first->d_written_when_read).find("on_demand") != string::npos);
+        CPPUNIT_ASSERT(second->d_written_when_read > first->d_written_when_read);
+        CPPUNIT_ASSERT(streamed.substr(0, second->d_written_when_read).find("[1, 2, 3, 4]") != string::npos);
+
+        // Each variable was freed once it had been written
+        CPPUNIT_ASSERT(!first->read_p() && !second->read_p());
+
+        // Read up front, the variables are written just as before
+        first->read();
+        second->read();
+        output.str("");
+        FoDapJsonTransform read_ft(&dds);
+        read_ft.transform(output, true);
+        CPPUNIT_ASSERT(output.str() == streamed);
+    }
+
+    // A large Array read in slabs is written just as it is when read whole
+    void test_read_in_slabs()
+    {
+        unsigned int most_read = 0;
+        libdap::DataDDS dds(0, "slabs");
+        libdap::Int32 proto("proto");
+        SlabArray a("a", &proto, &most_read);
+        a.append_dim(100, "x");
+        a.add_constraint(a.dim_begin(), 3, 2, 97);      // 48 values
+        a.set_send_p(true);
+        dds.add_var(&a);
+
+        libdap::ConstraintEvaluator eval;
+        FoInstanceJsonTransform ft(&dds);
+        ft.set_read_as_written(&eval);
+        ft.set_slab_bytes(10 * sizeof(libdap::dods_int32));
+        ostringstream slabs;
+        ft.transform(slabs, true);
+        CPPUNIT_ASSERT(most_read == 10);
+
+        (*dds.var_begin())->read();
+        FoInstanceJsonTransform whole_ft(&dds);
+        ostringstream whole;
+        whole_ft.transform(whole, true);
+        DBG(cerr << "test_read_in_slabs() - " << endl << slabs.str() << endl);
+        CPPUNIT_ASSERT(slabs.str() == whole.str());
+    }
+
+    // Each variable is freed once it is written and the response is the same
+    void test_release_data()
+    {
+        libdap::DataDDS *test_DDS = makeTestDDS();
+
+        ostringstream kept;
+        FoDapJsonTransform kept_ft(test_DDS);
+        kept_ft.transform(kept, true);
+
+        ostringstream released;
+        FoDapJsonTransform ft(test_DDS);
+        ft.set_release_data(true);
+        ft.transform(released, true);
+        CPPUNIT_ASSERT(released.str() == kept.str());
+
+        for (libdap::DDS::Vars_iter i = test_DDS->var_begin(); i != test_DDS->var_end(); ++i)
+            if ((*i)->send_p()) CPPUNIT_ASSERT(!(*i)->read_p());
+
+        delete test_DDS;
+    }
+
+    // The memory a response needs is estimated before it is read, and one
+    // that does not fit is read as it is written or refused
+    void test_admit_response()
+    {
+        libdap::DataDDS dds(0, "memory");
+        libdap::Int32 proto("proto");
+        libdap::Array a("a", &proto);
+        a.append_dim(1000, "x");
+        a.add_constraint(a.dim_begin(), 0, 10, 999);    // 100 values, 400 bytes
+        a.set_send_p(true);
+        dds.add_var(&a);
+        libdap::Array b("b", &proto);
+        b.append_dim(10, "y");
+        b.append_dim(1000, "x");                        // 10 rows of 4000 bytes
+        b.set_send_p(true);
+        dds.add_var(&b);
+        libdap::Float64 f("f");
+        f.set_send_p(true);
+        dds.add_var(&f);
+        libdap::Float64 unsent("unsent");
+        dds.add_var(&unsent);
+
+        CPPUNIT_ASSERT(estimate_memory(&dds, false, 0, 1) == 40408);
+        CPPUNIT_ASSERT(estimate_memory(&dds, true, 0, 1) == 40000);        // only b
+        CPPUNIT_ASSERT(estimate_memory(&dds, true, 8000, 1) == 8000);      // two rows of b
+        // Written on threads, the text of every variable may be held too
+        CPPUNIT_ASSERT(estimate_memory(&dds, false, 0, 4) == 40408 + 40408 * text_bytes_per_value_byte);
+        CPPUNIT_ASSERT(estimate_memory(&dds, true, 0, 4) == 40000);
+
+        bool read_as_written = false;
+        unsigned long slab_bytes = 0;
+        admit_response(&dds, 50000, 1, read_as_written, slab_bytes);
+        CPPUNIT_ASSERT(!read_as_written && slab_bytes == 0);
+
+        admit_response(&dds, 10000, 1, read_as_written, slab_bytes);
+        CPPUNIT_ASSERT(read_as_written && slab_bytes == 10000);
+
+        try {
+            read_as_written = false;
+            slab_bytes = 0;
+            admit_response(&dds, 1000, 1, read_as_written, slab_bytes);      // one row is 4000 bytes
+            CPPUNIT_FAIL("A response whose rows are larger than the limit should not fit");
+        }
+        catch (BESSyntaxUserError &e) {
+            DBG(cerr << "test_admit_response() - " << e.get_message() << endl);
+            CPPUNIT_ASSERT(!read_as_written);
+        }
+
+        // A constraint that calls functions cannot be estimated
+        admit_response(0, 1000, 1, read_as_written, slab_bytes);
+        CPPUNIT_ASSERT(!read_as_written);
+
+        // An encoded constraint is decoded before the response is
+        // estimated, and what is admitted is read as intern_dap2_data()
+        // would read it: a[0:10:999] is 100 bytes; all of a and b is 11000
+        uint64_t values_read = 0;
+        libdap::DataDDS *encoded = new libdap::DataDDS(0, "encoded");
+        libdap::Byte byte_proto("proto");
+        ZeroArray za("a", &byte_proto, &values_read);
+        za.append_dim(1000, "x");
+        encoded->add_var(&za);
+        ZeroArray zb("b", &byte_proto, &values_read);
+        zb.append_dim(10, "y");
+        zb.append_dim(1000, "x");
+        encoded->add_var(&zb);
+
+        BESDataDDSResponse response(encoded);
+        BESDataHandlerInterface dhi;
+        dhi.data[POST_CONSTRAINT] = "a%5B0:10:999%5D";
+        libdap::ConstraintEvaluator *eval = 0;
+        libdap::DDS *constrained = constrain_dds(&response, dhi, &eval);
+        read_as_written = false;
+        slab_bytes = 0;
+        admit_response(constrained, 1000, 1, read_as_written, slab_bytes);
+        CPPUNIT_ASSERT(!read_as_written && slab_bytes == 0);
+
+        read_data(constrained, *eval);
+        CPPUNIT_ASSERT(values_read == 100);
+        CPPUNIT_ASSERT(constrained->var("a")->read_p() && !constrained->var("b")->read_p());
+    }
+
+    // A DDS with an Array a of 1000 Int32s and an Array b of 10 rows of 1000
+    libdap::DataDDS *makeConstrainDDS()
+    {
+        libdap::DataDDS *dds = new libdap::DataDDS(0, "constrain");
+        libdap::Int32 proto("proto");
+        libdap::Array a("a", &proto);
+        a.append_dim(1000, "x");
+        dds->add_var(&a);
+        libdap::Array b("b", &proto);
+        b.append_dim(10, "y");
+        b.append_dim(1000, "x");
+        dds->add_var(&b);
+        return dds;
+    }
+
+    // The constraint is decoded and the response limit applied as
+    // intern_dap2_data() does
+    void test_constrain_dds()
+    {
+        BESDataDDSResponse response(makeConstrainDDS());
+        BESDataHandlerInterface dhi;
+        dhi.data[POST_CONSTRAINT] = "a%5B0:10:999%5D";
+        libdap::ConstraintEvaluator *eval = 0;
+        libdap::DDS *dds = constrain_dds(&response, dhi, &eval);
+        CPPUNIT_ASSERT(dds == response.get_dds() && eval == &response.get_ce());
+
+        libdap::Array *a = static_cast<libdap::Array *>(dds->var("a"));
+        CPPUNIT_ASSERT(a->send_p() && !dds->var("b")->send_p());
+        CPPUNIT_ASSERT(a->dimension_size(a->dim_begin(), true) == 100);
+
+        // 40400 bytes against a limit of 1KB
+        BESDataDDSResponse limited(makeConstrainDDS());
+        limited.get_dds()->set_response_limit(1);
+        dhi.data[POST_CONSTRAINT] = "a%5B0:10:999%5D,b";
+        CPPUNIT_ASSERT_THROW(constrain_dds(&limited, dhi, &eval), libdap::Error);
+    }
+
+    // Variables written on several threads make the same response as when
+    // they are written in turn
+    void test_parallel_serialization()
+    {
+        libdap::DataDDS dds(0, "parallel");
+        libdap::Int32 proto("proto");
+        for (int i = 0; i < 12; i++) {
+            ostringstream name;
+            name << "a" << i;
+            libdap::Array a(name.str(), &proto);
+            a.append_dim(5 + i, "x");
+            vector<libdap::dods_int32> values;
+            for (int j = 0; j < 5 + i; j++)
+                values.push_back(i * 100 + j);
+            a.set_value(&values[0], values.size());
+            a.get_attr_table().append_attr("units", "String", "m");
+            a.set_send_p(true);
+            dds.add_var(&a);
+        }
+        // Too large to be held as text; written in turn, between the others
+        libdap::Array big("big", &proto);
+        vector<libdap::dods_int32> big_values(max_task_bytes / sizeof(libdap::dods_int32) + 1, 7);
+        big.append_dim(big_values.size(), "x");
+        big.set_value(&big_values[0], big_values.size());
+        big.set_send_p(true);
+        dds.add_var(&big);
+        libdap::Float64 f("f");
+        f.set_value(2.5);
+        libdap::Str str("str");
+        str.set_value("a \"quoted\" string");
+        libdap::Structure st("st");
+        st.add_var(&f);
+        st.add_var(&str);
+        st.set_send_p(true);
+        dds.add_var(&st);
+        dds.add_var(&f);
+        (*(dds.var_end() - 1))->set_send_p(true);
+
+        for (int compact = 0; compact < 2; compact++) {
+            for (int send_data = 0; send_data < 2; send_data++) {
+                FoDapJsonTransform serial(&dds);
+                serial.set_compact(compact);
+                ostringstream serial_out;
+                serial.transform(serial_out, send_data);
+
+                FoDapJsonTransform parallel(&dds);
+                parallel.set_compact(compact);
+                parallel.set_threads(4);
+                ostringstream parallel_out;
+                parallel.transform(parallel_out, send_data);
+                CPPUNIT_ASSERT(parallel_out.str() == serial_out.str());
+
+                FoInstanceJsonTransform instance_serial(&dds);
+                instance_serial.set_compact(compact);
+                ostringstream instance_serial_out;
+                instance_serial.transform(instance_serial_out, send_data);
+
+                FoInstanceJsonTransform instance_parallel(&dds);
+                instance_parallel.set_compact(compact);
+                instance_parallel.set_threads(4);
+                ostringstream instance_parallel_out;
+                instance_parallel.transform(instance_parallel_out, send_data);
+                DBG(cerr << "test_parallel_serialization() - " << endl << instance_parallel_out.str() << endl);
+                CPPUNIT_ASSERT(instance_parallel_out.str() == instance_serial_out.str());
+            }
+        }
+
+        // Tasks come back in the order they were given; one that fails
+        // throws what it threw when it is returned
+        TaskQueue tasks(3);
+        for (int i = 0; i < 10; i++)
+            tasks.submit(new OrderTask(i, i == 7));
+        for (int i = 0; i < 7; i++) {
+            OrderTask *task = static_cast<OrderTask *>(tasks.next());
+            CPPUNIT_ASSERT(task->d_number == i);
+            delete task;
+        }
+        try {
+            delete tasks.next();
+            CPPUNIT_FAIL("The failed task should throw");
+        }
+        catch (BESSyntaxUserError &e) {
+            CPPUNIT_ASSERT(e.get_message() == "task failed");
+        }
+        CPPUNIT_ASSERT(tasks.size() == 2);
+    }
+
+    // The shape and slabs of an Array with more values than 32 bits can count
+    void test_large_shape()
+    {
+        uint64_t values_read = 0;
+        libdap::Byte proto("proto");
+        ZeroArray a("a", &proto, &values_read);
+        a.append_dim(100000, "y");
+        a.append_dim(100000, "x");
+        a.set_send_p(true);
+
+        vector<unsigned int> shape(a.dimensions(true));
+        CPPUNIT_ASSERT(computeConstrainedShape(&a, &shape) == 10000000000ULL);
+        CPPUNIT_ASSERT(row_size(shape) == 100000);
+
+        // Too many values to read whole, so it is read in slabs even when
+        // FoJson.SlabBytes is 0; no slab holds more values than an int can count
+        CPPUNIT_ASSERT(slab_rows(&a, shape, 1, 0) == INT_MAX / 100000);
+        CPPUNIT_ASSERT(slab_rows(&a, shape, 1, 1000000) == 10);
+
+        a.add_constraint(a.dim_begin(), 0, 1, 9);
+        computeConstrainedShape(&a, &shape);
+        CPPUNIT_ASSERT(slab_rows(&a, shape, 1, 0) == 0);
+        CPPUNIT_ASSERT(values_read == 0);
+    }
+
+    // Write an Array of more than 2^32 values, a slab at a time. This writes
+    // about 13GB (counted, not kept) and takes a while, so it only runs when
+    // the tests are run with -l.
+    void test_large_array()
+    {
+        if (!large) return;
+
+        uint64_t values_read = 0;
+        libdap::DataDDS dds(0, "large");
+        libdap::Byte proto("proto");
+        ZeroArray a("a", &proto, &values_read);
+        a.append_dim(65537, "y");
+        a.append_dim(65536, "x");
+        a.set_send_p(true);
+        dds.add_var(&a);
+
+        libdap::ConstraintEvaluator eval;
+        FoInstanceJsonTransform ft(&dds);
+        ft.set_read_as_written(&eval);
+        ft.set_slab_bytes(64 * 1024 * 1024);
+        CountingStreambuf counted;
+        ostream output(&counted);
+        ft.transform(output, true);
+
+        // Every value was read exactly once and written as "0" and a separator
+        CPPUNIT_ASSERT(values_read == 65537ULL * 65536ULL);
+        CPPUNIT_ASSERT(counted.count() > 2 * values_read);
+        DBG(cerr << "test_large_array() - " << counted.count() << " bytes" << endl);
+    }
+
+    // The size worked out from the values is the length of the response
+    void test_response_size()
+    {
+        libdap::DataDDS dds(0, "sized");
+
+        libdap::Byte byte_proto("bytes");
+        libdap::Array bytes("bytes", &byte_proto);
+        libdap::dods_byte byte_values[] = { 0, 9, 10, 99, 100, 255 };
+        bytes.append_dim(6, "x");
+        bytes.set_value(byte_values, 6);
+        dds.add_var(&bytes);
+
+        libdap::Int16 i16_proto("i16");
+        libdap::Array i16("i16", &i16_proto);
+        libdap::dods_int16 i16_values[] = { -32768, -1, 0, 7, 32767, 10 };
+        i16.append_dim(2, "y");
+        i16.append_dim(3, "x");
+        i16.set_value(i16_values, 6);
+        dds.add_var(&i16);
+
+        libdap::UInt16 ui16_proto("ui16");
+        libdap::Array ui16("ui16", &ui16_proto);
+        libdap::dods_uint16 ui16_values[] = { 0, 65535, 1000 };
+        ui16.append_dim(3, "x");
+        ui16.set_value(ui16_values, 3);
+        dds.add_var(&ui16);
+
+        libdap::Int32 i32_proto("i32");
+        libdap::Array i32("i32", &i32_proto);
+        libdap::dods_int32 i32_values[] = { INT_MIN, -100000, 0, 123456789, INT_MAX };
+        i32.append_dim(5, "x");
+        i32.set_value(i32_values, 5);
+        dds.add_var(&i32);
+
+        libdap::UInt32 ui32_proto("ui32");
+        libdap::Array ui32("ui32", &ui32_proto);
+        libdap::dods_uint32 ui32_values[] = { 0, 4294967295U, 1000000000 };
+        ui32.append_dim(3, "x");
+        ui32.set_value(ui32_values, 3);
+        dds.add_var(&ui32);
+
+        libdap::Float32 f32_proto("f32");
+        libdap::Array f32("f32", &f32_proto);
+        libdap::dods_float32 f32_values[] = { 0.1f, NAN, -HUGE_VALF, 1e-30f, 3.0f };
+        f32.append_dim(5, "x");
+        f32.set_value(f32_values, 5);
+        dds.add_var(&f32);
+
+        libdap::Float64 f64_proto("f64");
+        libdap::Array f64("f64", &f64_proto);
+        libdap::dods_float64 f64_values[] = { atan(1) * 4, HUGE_VAL, NAN, -2.5e300, 0 };
+        f64.append_dim(5, "x");
+        f64.set_value(f64_values, 5);
+        f64.get_attr_table().append_attr("units", "String", "degrees \"C\"");
+        dds.add_var(&f64);
+
+        libdap::Str str_proto("strs");
+        libdap::Array strs("strs", &str_proto);
+        vector<string> str_values;
+        str_values.push_back("plain");
+        str_values.push_back("a \"quoted\"\\ string\n\twith\x01 controls");
+        str_values.push_back("");
+        strs.append_dim(3, "x");
+        strs.set_value(str_values, 3);
+        dds.add_var(&strs);
+
+        libdap::Float64 f("f");
+        f.set_value(1.0 / 3);
+        libdap::Str s("s");
+        s.set_value("tab\there");
+        libdap::Structure st("st");
+        st.add_var(&f);
+        st.add_var(&s);
+        dds.add_var(&st);
+        libdap::Int16 scalar("scalar");
+        scalar.set_value(-42);
+        dds.add_var(&scalar);
+
+        for (libdap::DDS::Vars_iter i = dds.var_begin(); i != dds.var_end(); ++i)
+            (*i)->set_send_p(true);
+
+        PrecisionSpec precision;
+        precision.parse("f64:3");
+        for (int compact = 0; compact < 2; compact++) {
+            for (int send_data = 0; send_data < 2; send_data++) {
+                for (int non_finite = 0; non_finite < 2; non_finite++) {
+                    uint64_t size = 0;
+                    ostringstream output;
+
+                    FoDapJsonTransform ft(&dds);
+                    ft.set_compact(compact);
+                    if (non_finite) ft.set_non_finite_as("\"NaN\"");
+                    ft.set_precision(precision);
+                    CPPUNIT_ASSERT(ft.size(send_data, size));
+                    ft.transform(output, send_data);
+                    DBG(cerr << "test_response_size() - " << size << " bytes" << endl << output.str() << endl);
+                    CPPUNIT_ASSERT(size == output.str().size());
+
+                    FoInstanceJsonTransform instance(&dds);
+                    instance.set_compact(compact);
+                    if (non_finite) instance.set_non_finite_as("\"NaN\"");
+                    instance.set_precision(precision);
+                    CPPUNIT_ASSERT(instance.size(send_data, size));
+                    output.str("");
+                    instance.transform(output, send_data);
+                    DBG(cerr << "test_response_size() - " << size << " bytes" << endl << output.str() << endl);
+                    CPPUNIT_ASSERT(size == output.str().size());
+                }
+            }
+        }
+
+        // The values of a Sequence and of variables read as they are
+        // written are not known until they are sent
+        uint64_t size = 0;
+        libdap::DataDDS *test_DDS = makeTestDDS();
+        FoInstanceJsonTransform sequence(test_DDS);
+        CPPUNIT_ASSERT(!sequence.size(true, size));
+        CPPUNIT_ASSERT(sequence.size(false, size));
+        delete test_DDS;
+
+        libdap::ConstraintEvaluator eval;
+        FoDapJsonTransform on_demand(&dds);
+        on_demand.set_read_as_written(&eval);
+        CPPUNIT_ASSERT(!on_demand.size(true, size));
+    }
+
+    // Only text that is valid JSON may stand in for NaN and Inf
+    void test_is_json_scalar()
+    {
+        const char *valid[] = { "null", "0", "-9999", "1.5", "-0.25e-3", "1E10", "\"NaN\"", "\"\"",
+            "\"a \\\"b\\\" \\u00e9\\n\"" };
+        for (unsigned int i = 0; i < sizeof(valid) / sizeof(valid[0]); i++)
+            CPPUNIT_ASSERT(is_json_scalar(valid[i]));
+
+        const char *invalid[] = { "", "NaN", "nan", "inf", "-Infinity", "Null", "01", "1.", ".5", "+1", "1e",
+            "- 1", "\"", "\"open", "\"bad \\x escape\"", "\"\\u12\"", "\"trailing\\\"", "\"a\"b\"" };
+        for (unsigned int i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+            CPPUNIT_ASSERT(!is_json_scalar(invalid[i]));
+    }
+
+    void test_format_number_round_trip()
+    {
+        char buf[max_number_chars + 1];
+
+        libdap::dods_float64 f64[] = { 0.0, -0.0, 0.1, 1.0 / 3.0, atan(1) * 4, 5e-324, 2.2250738585072014e-308,
+            1.7976931348623157e308, 123456789012345678.0, -10245.1234, 1e21 };
+        for (unsigned int i = 0; i < sizeof(f64) / sizeof(f64[0]); i++) {
+            *format_number(buf, f64[i]) = '\0';
+            DBG(cerr << "format_number(" << f64[i] << "): " << buf << endl);
+            CPPUNIT_ASSERT(strtod(buf, 0) == f64[i]);
+        }
+
+        // Float32 values are formatted as floats, not as widened doubles
+        libdap::dods_float32 f32[] = { 0.1f, 5.7866f, 1.0f / 3.0f, 1e-45f, 3.4028235e38f, 16777216.0f };
+        for (unsigned int i = 0; i < sizeof(f32) / sizeof(f32[0]); i++) {
+            *format_number(buf, f32[i]) = '\0';
+            DBG(cerr << "format_number(" << f32[i] << "): " << buf << endl);
+            CPPUNIT_ASSERT(strtof(buf, 0) == f32[i]);
+        }
+
+        *format_number(buf, 0.1f) = '\0';
+        CPPUNIT_ASSERT(string(buf) == "0.1");
+        *format_number(buf, 0.1) = '\0';
+        CPPUNIT_ASSERT(string(buf) == "0.1");
+    }
+
+    void test_format_number_integers()
+    {
+        char buf[max_number_chars + 1];
+
+        libdap::dods_int32 i32[] = { 0, 7, -7, 10, 99, 100, -105467, 1000000000, 2147483647, -2147483647 - 1 };
+        for (unsigned int i = 0; i < sizeof(i32) / sizeof(i32[0]); i++) {
+            *format_number(buf, i32[i]) = '\0';
+            ostringstream oss;
+            oss << i32[i];
+            CPPUNIT_ASSERT(oss.str() == buf);
+        }
+
+        *format_number(buf, (libdap::dods_uint32) 4294967295u) = '\0';
+        CPPUNIT_ASSERT(string(buf) == "4294967295");
+        *format_number(buf, (libdap::dods_int16) -32768) = '\0';
+        CPPUNIT_ASSERT(string(buf) == "-32768");
+        *format_number(buf, (libdap::dods_uint16) 65535) = '\0';
+        CPPUNIT_ASSERT(string(buf) == "65535");
+    }
+
+    // Return the text write_values() produces for 'count' values
+    template<typename T>
+    string written(const T *values, unsigned int count, const ValueFormat &format = ValueFormat(),
+        bool compact = false)
+    {
+        ostringstream oss;
+        JsonWriter writer(oss, compact);
+        write_values(&writer, values, count, format);
+        writer.flush();
+        return oss.str();
+    }
+
+    void test_write_values_bytes()
+    {
+        libdap::dods_byte bytes[] = { 0, 7, 28, 100, 238, 255 };
+
+        DBG(cerr << "write_values(bytes): " << written(bytes, sizeof(bytes)) << endl);
+        CPPUNIT_ASSERT(written(bytes, sizeof(bytes)) == "0, 7, 28, 100, 238, 255");
+        CPPUNIT_ASSERT(written(bytes + 5, 1) == "255");
+        CPPUNIT_ASSERT(written(bytes, sizeof(bytes), ValueFormat(), true) == "0,7,28,100,238,255");
+
+        libdap::dods_int32 ints[] = { -1, 0, 2147483647 };
+        CPPUNIT_ASSERT(written(ints, 3, ValueFormat(), true) == "-1,0,2147483647");
+    }
+
+    void test_write_values_non_finite()
+    {
+        // Long enough that both the vector scan and the scalar tail are used
+        vector<libdap::dods_float64> values(101, 0.5);
+        CPPUNIT_ASSERT(all_finite(&values[0], values.size()));
+
+        values[97] = HUGE_VAL;
+        CPPUNIT_ASSERT(!all_finite(&values[0], values.size()));
+        values[97] = 0.5;
+        values[3] = -HUGE_VAL;
+        CPPUNIT_ASSERT(!all_finite(&values[0], values.size()));
+
+        libdap::dods_float64 doubles[] = { 1.5, NAN, -HUGE_VAL, 2 };
+        DBG(cerr << "write_values(doubles): " << written(doubles, 4) << endl);
+        CPPUNIT_ASSERT(written(doubles, 4) == "1.5, null, null, 2");
+
+        libdap::dods_float32 floats[] = { NAN, 0.25f, HUGE_VALF };
+        ValueFormat format;
+        format.non_finite = "\"NaN\"";
+        DBG(cerr << "write_values(floats): " << written(floats, 3, format) << endl);
+        CPPUNIT_ASSERT(written(floats, 3, format) == "\"NaN\", 0.25, \"NaN\"");
+    }
+
+    string format_precision(double value, int precision)
+    {
+        char buf[max_number_chars];
+        return string(buf, format_number(buf, value, precision));
+    }
+
+    void test_format_number_precision()
+    {
+        CPPUNIT_ASSERT(format_precision(10245.1234, 3) == "1.02e+04");
+        CPPUNIT_ASSERT(format_precision(10245.1234, 6) == "10245.1");
+        CPPUNIT_ASSERT(format_precision(-0.000123456, 2) == "-0.00012");
+        CPPUNIT_ASSERT(format_precision(99.96, 3) == "100");
+        CPPUNIT_ASSERT(format_precision(9.99, 1) == "1e+01");
+        CPPUNIT_ASSERT(format_precision(1.5, 6) == "1.5");
+        CPPUNIT_ASSERT(format_precision(0, 4) == "0");
+        CPPUNIT_ASSERT(format_precision(0.1, 0) == "0.1");
+
+        // Never more digits than the shortest representation
+        char buf[max_number_chars];
+        CPPUNIT_ASSERT(string(buf, format_number(buf, 0.1f, 9)) == "0.1");
+
+        libdap::dods_float64 values[] = { 3.14159265, NAN, 2.71828183 };
+        ValueFormat format;
+        format.precision = 3;
+        DBG(cerr << "write_values(precision 3): " << written(values, 3, format) << endl);
+        CPPUNIT_ASSERT(written(values, 3, format) == "3.14, null, 2.72");
+    }
+
+    void test_precision_spec()
+    {
+        libdap::Float64 time("time");
+        libdap::Float64 sst("sst");
+        libdap::Float64 lat("lat");
+
+        PrecisionSpec spec;
+        CPPUNIT_ASSERT(spec.get_precision(&sst) == 0);
+
+        spec.parse("4, time:0,sst:3");
+        CPPUNIT_ASSERT(spec.get_precision(&time) == 0);
+        CPPUNIT_ASSERT(spec.get_precision(&sst) == 3);
+        CPPUNIT_ASSERT(spec.get_precision(&lat) == 4);
+
+        // A second spec (the request's) replaces entries of the first
+        spec.parse("sst:5");
+        CPPUNIT_ASSERT(spec.get_precision(&sst) == 5);
+        CPPUNIT_ASSERT(spec.get_precision(&lat) == 4);
+
+        CPPUNIT_ASSERT_THROW(spec.parse("sst:x"), BESSyntaxUserError);
+        CPPUNIT_ASSERT_THROW(spec.parse("-1"), BESSyntaxUserError);
+    }
+
+    void test_json_writer()
+    {
+        // The smallest buffer the writer allows, so that everything below
+        // fills it more than once
+        ostringstream oss;
+        JsonWriter writer(oss, false, 1);
+
+        string long_value(1000, 'x');
+        writer.raw('{').newline().key("name").quoted("a \"b\"").separator();
+        writer.key("value").raw('[').number(-1.5).separator().number(42).raw(']').separator();
+        writer.key("long").quoted(long_value).newline().raw('}');
+
+        string expected = "{\n\"name\": \"a \\u0022b\\u0022\", \"value\": [-1.5, 42], \"long\": \"" + long_value + "\"\n}";
+
+        // The tail of the text stays in the buffer until it is flushed
+        CPPUNIT_ASSERT(oss.str().length() < expected.length());
+        CPPUNIT_ASSERT(oss.str() == expected.substr(0, oss.str().length()));
+        writer.flush();
+
+        DBG(cerr << "JsonWriter: " << oss.str() << endl);
+        CPPUNIT_ASSERT(oss.str() == expected);
+
+        ostringstream compact;
+        JsonWriter compact_writer(compact, true);
+        compact_writer.raw('{').newline().key("a").raw('[').number(1).separator().number(2).raw(']').raw('}');
+        compact_writer.flush();
+        CPPUNIT_ASSERT(compact.str() == "{\"a\":[1,2]}");
+    }
+
+    // Decompress a zlib or gzip stream
+    string inflated(const string &compressed)
+    {
+        z_stream zs;
+        zs.zalloc = Z_NULL;
+        zs.zfree = Z_NULL;
+        zs.opaque = Z_NULL;
+        zs.next_in = (Bytef *) compressed.data();
+        zs.avail_in = compressed.length();
+        // 32 detects the zlib or gzip header
+        CPPUNIT_ASSERT(inflateInit2(&zs, 15 + 32) == Z_OK);
+
+        string result;
+        char buf[4096];
+        int status;
+        do {
+            zs.next_out = (Bytef *) buf;
+            zs.avail_out = sizeof(buf);
+            status = inflate(&zs, Z_NO_FLUSH);
+            CPPUNIT_ASSERT(status == Z_OK || status == Z_STREAM_END);
+            result.append(buf, sizeof(buf) - zs.avail_out);
+        } while (status != Z_STREAM_END);
+        inflateEnd(&zs);
+
+        return result;
+    }
+
+    void test_deflate_stream()
+    {
+        CPPUNIT_ASSERT(parse_compression("gzip") == gzip_compression);
+        CPPUNIT_ASSERT(parse_compression("none") == no_compression);
+        CPPUNIT_ASSERT_THROW(parse_compression("zip"), BESSyntaxUserError);
+
+        // Larger than the stream's buffers, with writes both smaller and
+        // larger than them
+        vector<libdap::dods_int32> values(100000);
+        for (unsigned int i = 0; i < values.size(); i++)
+            values[i] = i * 7919;
+
+        ostringstream plain;
+        JsonWriter plain_writer(plain);
+        write_values(&plain_writer, &values[0], values.size());
+        plain_writer.flush();
+
+        Compression compressions[] = { deflate_compression, gzip_compression };
+        for (unsigned int c = 0; c < 2; c++) {
+            ostringstream compressed;
+            DeflateStream z_strm(compressed, compressions[c], 6);
+            z_strm << "[";
+            z_strm.flush();
+            // Flushed data can be decoded before the stream is finished
+            CPPUNIT_ASSERT(compressed.str().length() > 0);
+
+            JsonWriter writer(z_strm);
+            write_values(&writer, &values[0], values.size());
+            writer.raw(']');
+            writer.flush();
+            z_strm.finish();
+
+            DBG(cerr << "DeflateStream: " << plain.str().length() << " to " << compressed.str().length() << " bytes" << endl);
+            CPPUNIT_ASSERT(compressed.str().length() < plain.str().length() / 2);
+            CPPUNIT_ASSERT(inflated(compressed.str()) == "[" + plain.str() + "]");
+        }
+    }
+
+    void test_parallel_deflate_stream()
+    {
+        // Many blocks, so that the threads share the work
+        vector<libdap::dods_int32> values(200000);
+        for (unsigned int i = 0; i < values.size(); i++)
+            values[i] = i * 7919;
+
+        ostringstream plain;
+        JsonWriter plain_writer(plain);
+        write_values(&plain_writer, &values[0], values.size());
+        plain_writer.flush();
+
+        Compression compressions[] = { deflate_compression, gzip_compression };
+        for (unsigned int c = 0; c < 2; c++) {
+            ostringstream compressed;
+            ParallelDeflateStream z_strm(compressed, compressions[c], 6, 3);
+            z_strm << "[";
+            z_strm.flush();
+            CPPUNIT_ASSERT(compressed.str().length() > 0);
+
+            JsonWriter writer(z_strm);
+            write_values(&writer, &values[0], values.size());
+            writer.raw(']');
+            writer.flush();
+            z_strm.finish();
+
+            DBG(cerr << "ParallelDeflateStream: " << plain.str().length() << " to " << compressed.str().length() << " bytes" << endl);
+            CPPUNIT_ASSERT(inflated(compressed.str()) == "[" + plain.str() + "]");
+        }
+
+        // An empty response is still a valid stream
+        ostringstream empty;
+        ParallelDeflateStream empty_strm(empty, gzip_compression, 6, 2);
+        empty_strm.finish();
+        CPPUNIT_ASSERT(inflated(empty.str()) == "");
+    }
+
+    void test_spill_file()
+    {
+        // Larger than one of the blocks used to copy the file
+        string document(3 * 1024 * 1024 + 17, 'x');
+        for (unsigned int i = 0; i < document.length(); i += 101)
+            document[i] = '0' + i % 10;
+
+        SpillFile spill(TEST_BUILD_DIR);
+        spill.stream() << document;
+        ostringstream sent;
+        spill.send(sent);
+        CPPUNIT_ASSERT(sent.str() == document);
+
+        // Smaller than the buffer the file is written from
+        SpillFile small(TEST_BUILD_DIR);
+        small.stream() << "{}";
+        ostringstream small_sent;
+        small.send(small_sent);
+        CPPUNIT_ASSERT(small_sent.str() == "{}");
+
+#ifdef __GLIBCXX__
+        // A stream that writes to a file descriptor is sent with sendfile
+        string name = (string) TEST_BUILD_DIR + "/spill_file_test.json";
+        FILE *out = fopen(name.c_str(), "w+");
+        CPPUNIT_ASSERT(out);
+        {
+            SpillFile spill(TEST_BUILD_DIR);
+            spill.stream() << document;
+            __gnu_cxx::stdio_sync_filebuf<char> buf(out);
+            ostream out_strm(&buf);
+            out_strm << "[";
+            spill.send(out_strm);
+            out_strm << "]";
+            out_strm.flush();
+        }
+        rewind(out);
+        string received(document.length() + 2, '\0');
+        CPPUNIT_ASSERT(fread(&received[0], 1, received.length(), out) == received.length());
+        fclose(out);
+        remove(name.c_str());
+        CPPUNIT_ASSERT(received == "[" + document + "]");
+#endif
+
+        try {
+            SpillFile missing("/no/such/directory");
+            CPPUNIT_FAIL("Made a temporary file in a missing directory");
+        }
+        catch (BESInternalError &e) {
+            DBG(cerr << e.get_message() << endl);
+        }
+    }
+
+#ifdef HAVE_ZSTD
+    // Compress a document with zstd, flushing part way, and check that it
+    // decompresses to the same document.
+    string zstd_round_trip(const string &document, const ZSTD_CDict *cdict, const string &dictionary)
+    {
+        ostringstream compressed;
+        ZstdStream z_strm(compressed, 6, cdict);
+        z_strm << document.substr(0, 100);
+        z_strm.flush();
+        z_strm << document.substr(100);
+        z_strm.finish();
+
+        string decompressed(document.length(), '\0');
+        ZSTD_DCtx *dctx = ZSTD_createDCtx();
+        size_t n = ZSTD_decompress_usingDict(dctx, &decompressed[0], decompressed.length(), compressed.str().data(),
+            compressed.str().length(), dictionary.data(), dictionary.length());
+        ZSTD_freeDCtx(dctx);
+        CPPUNIT_ASSERT(!ZSTD_isError(n) && n == document.length());
+        CPPUNIT_ASSERT(decompressed == document);
+
+        return compressed.str();
+    }
+
+    void test_zstd_stream()
+    {
+        CPPUNIT_ASSERT(parse_compression("zstd") == zstd_compression);
+
+        string dictionary_file = (string) TEST_SRC_DIR + "/../fojson_metadata.dict";
+        ZstdDictionary::TheDictionary()->load(dictionary_file);
+        CPPUNIT_ASSERT(ZstdDictionary::TheDictionary()->loaded());
+        const ZSTD_CDict *cdict = ZstdDictionary::TheDictionary()->get_cdict(6);
+        CPPUNIT_ASSERT(cdict);
+        CPPUNIT_ASSERT(ZstdDictionary::TheDictionary()->get_cdict(6) == cdict);
+
+        string metadata = fileToString((string) TEST_SRC_DIR + "/baselines/instance_object_test_METADATA.json.baseline");
+        string plain = zstd_round_trip(metadata, 0, "");
+        string with_dictionary = zstd_round_trip(metadata, cdict, fileToString(dictionary_file));
+        DBG(cerr << "zstd: " << metadata.length() << " to " << plain.length() << " bytes, " << with_dictionary.length() << " with the dictionary" << endl);
+        CPPUNIT_ASSERT(with_dictionary.length() < plain.length());
+
+        ZstdDictionary::delete_instance();
+        CPPUNIT_ASSERT_THROW(ZstdDictionary::TheDictionary()->load(d_tmpDir + "/no_such_file"), BESInternalError);
+        ZstdDictionary::delete_instance();
+    }
+#endif
+
+    void test_escape_for_json()
+    {
+        // Long enough that both the vector scan and the scalar tail are used
+        string clean = "This string is long enough to need more than one vector compare.";
+        CPPUNIT_ASSERT(escape_for_json(clean) == clean);
+
+        string dirty = clean + "\"quoted\" back\\slash\ttab" + clean + "\n";
+        string expected = clean + "\\u0022quoted\\u0022 back\\u005cslash\\u0009tab" + clean + "\\u000a";
+        DBG(cerr << "escape_for_json(): " << escape_for_json(dirty) << endl);
+        CPPUNIT_ASSERT(escape_for_json(dirty) == expected);
+
+        string appended = "prefix:";
+        escape_for_json(dirty, appended);
+        CPPUNIT_ASSERT(appended == "prefix:" + expected);
+
+        ostringstream oss;
+        escape_for_json(&oss, dirty);
+        CPPUNIT_ASSERT(oss.str() == expected);
+
+        CPPUNIT_ASSERT(quote_for_json(dirty) == "\"" + expected + "\"");
+        CPPUNIT_ASSERT(quote_for_json("") == "\"\"");
+
+        // Bytes with the high bit set are passed through
+        CPPUNIT_ASSERT(escape_for_json("caf\xc3\xa9") == "caf\xc3\xa9");
+    }
+
     libdap::DataDDS *makeSimpleTypesDDS()
     {
         // build a DataDDS of simple types and set values for each of the
@@ -658,7 +1757,7 @@ CPPUNIT_TEST_SUITE_REGISTRATION(FoJsonTest);
 int main(int argc, char*argv[])
 {
 
-    GetOpt getopt(argc, argv, "d");
+    GetOpt getopt(argc, argv, "dl");
     int option_char;
     while ((option_char = getopt()) != -1)
         switch (option_char) {
@@ -666,6 +1765,9 @@ int main(int argc, char*argv[])
             debug = 1;  // debug is a static global
             cerr << "##### DEBUG is ON" << endl;
             break;
+        case 'l':
+            large = true;   // also run the tests that write very large Arrays
+            break;
         default:
             // I'd like the output to be clean unless -d is on so
             // nightly builds are easier to read/understand. jhrg 2/20/15